@@ -0,0 +1,461 @@
+/*
+ * coconut_bench.c - Microbenchmarks of Coconut primitives
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ *
+ * Usage: coconut_bench [-f csv|json] [-s suite]... [-t max_threads] [-n max_ids] [-g grace_ms]
+ * Sweeps thread counts (powers of two up to number of cores) and registry
+ * sizes (powers of ten from 10 up to max_ids) and prints one result per line.
+ * Suites:
+ *   lookup - c_is_event_published on registry of ids events, scattered over
+ *            registry, so cost still grows with ids as table outgrows caches
+ *   handoff - c_publish_event/c_wait_event ping-pong between thread pairs
+ *   blocks - c_begin_block/c_end_block pairs without ordering constraints
+ *   barrier - c_begin_block/c_end_block where every group spans all threads
+ *   parse - c_set_blocks_interleaving of never seen interleaving
+ *   parse_cached - c_set_blocks_interleaving of already compiled interleaving
+ *   watchdog - time from last thread blocking on unpublished event to release
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "coconut.h"
+
+#define MAX_THREADS 256
+#define NAME_SIZE 24
+#define LOOKUPS 1000000
+#define ROUNDS 2000
+#define PARSE_REPEATS 10
+
+/**
+ * Single measurement.
+ * suite - suite name
+ * threads - number of threads
+ * ids - registry size
+ * ops - number of operations done by all threads
+ * op_ns - sum of time threads spent, in nanoseconds
+ * wall_ns - wall clock time of whole measurement, in nanoseconds
+ */
+typedef struct
+{
+	const char *suite;
+	int threads;
+	int ids;
+	unsigned long ops;
+	double op_ns;
+	double wall_ns;
+} result_t;
+
+/**
+ * Arguments of worker thread.
+ * index - index of thread
+ * count - number of operations to do
+ * names - names to operate on
+ * peer_names - names published by peer, for handoff
+ * elapsed - time spent, filled by worker
+ */
+typedef struct
+{
+	int index;
+	int count;
+	char (*names)[NAME_SIZE];
+	char (*peer_names)[NAME_SIZE];
+	double elapsed;
+} worker_t;
+
+static const char *format = "csv";
+static int results_count = 0;
+static int max_ids = 100000;
+static int registry_ids = 0; // ids of current measurement, for lookup workers
+static char (*registry)[NAME_SIZE] = NULL; // "id%d" names, shared by suites
+
+static double now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const result_t *result)
+{
+	double ns_per_op = result->op_ns / result->ops;
+	double mops = result->ops / result->wall_ns * 1e3;
+
+	if (strcmp(format, "json") == 0)
+		printf("%s{\"suite\":\"%s\",\"threads\":%d,\"ids\":%d,\"ops\":%lu,\"ns_per_op\":%.1f,\"mops\":%.3f}",
+			results_count ? ",\n" : "[\n", result->suite, result->threads, result->ids, result->ops, ns_per_op, mops);
+	else
+		printf("%s%s,%d,%d,%lu,%.1f,%.3f\n", results_count ? "" : "suite,threads,ids,ops,ns_per_op,mops\n",
+			result->suite, result->threads, result->ids, result->ops, ns_per_op, mops);
+	fflush(stdout);
+	++results_count;
+}
+
+/* runs routine in threads workers, returns wall time and fills op_ns with their total time */
+static double run_workers(void *(*routine)(void *), worker_t *workers, int threads, double *op_ns)
+{
+	pthread_t ids[MAX_THREADS];
+	double start = now_ns();
+	int i;
+
+	for (i = 0; i < threads; ++i)
+		pthread_create(&ids[i], NULL, routine, &workers[i]);
+	*op_ns = 0;
+	for (i = 0; i < threads; ++i)
+	{
+		pthread_join(ids[i], NULL);
+		*op_ns += workers[i].elapsed;
+	}
+
+	return now_ns() - start;
+}
+
+static char (*make_names(const char *prefix, int count))[NAME_SIZE]
+{
+	char (*names)[NAME_SIZE] = malloc((size_t) (count ? count : 1) * NAME_SIZE);
+	int i;
+
+	for (i = 0; i < count; ++i)
+		snprintf(names[i], NAME_SIZE, "%s%d", prefix, i);
+
+	return names;
+}
+
+static char *join_names(char (*names)[NAME_SIZE], int count, int width)
+{
+	char *interleaving = malloc((size_t) count * (NAME_SIZE + 1) + 1);
+	size_t len = 0;
+	int i;
+
+	interleaving[0] = '\0';
+	for (i = 0; i < count; ++i)
+		len += sprintf(interleaving + len, "%s%s", i == 0 ? "" : (i % width ? "," : ";"), names[i]);
+
+	return interleaving;
+}
+
+/* makes registry of ids events, all of them published */
+static void fill_registry(int ids)
+{
+	int i;
+
+	for (i = 0; i < ids; ++i)
+		c_publish_event(registry[i]);
+	registry_ids = ids;
+}
+
+static void *lookup_worker(void *arg)
+{
+	worker_t *worker = arg;
+	double start = now_ns();
+	int hits = 0;
+	int i;
+
+	for (i = 0; i < worker->count; ++i)
+		hits += c_is_event_published(registry[((unsigned int) (i + worker->index) * 2654435761u) % registry_ids]);
+
+	worker->elapsed = now_ns() - start;
+	if (hits != worker->count)
+		fprintf(stderr, "lookup: %d of %d hits\n", hits, worker->count);
+
+	return NULL;
+}
+
+static void bench_lookup(int threads, int ids)
+{
+	worker_t workers[MAX_THREADS];
+	result_t result = { "lookup", threads, ids, (unsigned long) threads * LOOKUPS, 0, 0 };
+	int i;
+
+	c_init();
+	fill_registry(ids);
+
+	for (i = 0; i < threads; ++i)
+		workers[i] = (worker_t) { i, LOOKUPS, NULL, NULL, 0 };
+	result.wall_ns = run_workers(lookup_worker, workers, threads, &result.op_ns);
+
+	report(&result);
+	c_free();
+}
+
+/* even workers publish pings and wait for pongs, odd ones the other way round */
+static void *handoff_worker(void *arg)
+{
+	worker_t *worker = arg;
+	double start = now_ns();
+	int i;
+
+	for (i = 0; i < worker->count; ++i)
+		if (worker->index % 2 == 0)
+		{
+			c_publish_event(worker->names[i]);
+			c_wait_event(worker->peer_names[i]);
+		}
+		else
+		{
+			c_wait_event(worker->peer_names[i]);
+			c_publish_event(worker->names[i]);
+		}
+
+	worker->elapsed = now_ns() - start;
+
+	return NULL;
+}
+
+/* single thread publishes and waits for own events, no handoff at all */
+static void *self_handoff_worker(void *arg)
+{
+	worker_t *worker = arg;
+	double start = now_ns();
+	int i;
+
+	for (i = 0; i < worker->count; ++i)
+	{
+		c_publish_event(worker->names[i]);
+		c_wait_event(worker->names[i]);
+	}
+
+	worker->elapsed = now_ns() - start;
+
+	return NULL;
+}
+
+static void bench_handoff(int threads, int ids)
+{
+	worker_t workers[MAX_THREADS];
+	char (*names[MAX_THREADS])[NAME_SIZE];
+	char prefix[NAME_SIZE];
+	result_t result = { "handoff", threads, ids, 0, 0, 0 };
+	int i;
+
+	c_init();
+	fill_registry(ids);
+
+	for (i = 0; i < threads; ++i)
+	{
+		snprintf(prefix, sizeof(prefix), "h%d_", i);
+		names[i] = make_names(prefix, ROUNDS);
+	}
+	for (i = 0; i < threads; ++i)
+		workers[i] = (worker_t) { i, ROUNDS, names[i], names[i ^ 1], 0 };
+
+	// every round of pair is two handoffs, op_ns counts both threads of pair
+	result.ops = (unsigned long) threads * ROUNDS;
+	result.wall_ns = run_workers(threads == 1 ? self_handoff_worker : handoff_worker, workers, threads, &result.op_ns);
+
+	report(&result);
+	c_free();
+	for (i = 0; i < threads; ++i)
+		free(names[i]);
+}
+
+static void *blocks_worker(void *arg)
+{
+	worker_t *worker = arg;
+	double start = now_ns();
+	int i;
+
+	for (i = 0; i < worker->count; ++i)
+	{
+		c_begin_block(worker->names[i]);
+		c_end_block();
+	}
+
+	worker->elapsed = now_ns() - start;
+
+	return NULL;
+}
+
+/* width 0 puts all blocks in single group, otherwise groups span all threads */
+static void bench_blocks(const char *suite, int threads, int ids, int barrier)
+{
+	worker_t workers[MAX_THREADS];
+	char (*names)[NAME_SIZE];
+	char (*thread_names[MAX_THREADS])[NAME_SIZE];
+	result_t result = { suite, threads, ids, 0, 0, 0 };
+	int per_thread = ids / threads;
+	char *interleaving;
+	int i, j;
+
+	if (per_thread == 0)
+		return;
+
+	// block j of thread i is named b<j * threads + i>, so group j holds j-th blocks of all threads
+	names = make_names("b", per_thread * threads);
+	interleaving = join_names(names, per_thread * threads, barrier ? threads : per_thread * threads);
+	for (i = 0; i < threads; ++i)
+	{
+		thread_names[i] = malloc((size_t) per_thread * NAME_SIZE);
+		for (j = 0; j < per_thread; ++j)
+			memcpy(thread_names[i][j], names[j * threads + i], NAME_SIZE);
+		workers[i] = (worker_t) { i, per_thread, thread_names[i], NULL, 0 };
+	}
+
+	c_init();
+	c_set_blocks_interleaving(interleaving);
+
+	result.ops = (unsigned long) per_thread * threads;
+	result.wall_ns = run_workers(blocks_worker, workers, threads, &result.op_ns);
+
+	report(&result);
+	c_free();
+	for (i = 0; i < threads; ++i)
+		free(thread_names[i]);
+	free(interleaving);
+	free(names);
+}
+
+static void bench_parse(int ids, int cached)
+{
+	result_t result = { cached ? "parse_cached" : "parse", 1, ids, (unsigned long) ids * PARSE_REPEATS, 0, 0 };
+	char (*names)[NAME_SIZE];
+	char *interleavings[PARSE_REPEATS];
+	char prefix[NAME_SIZE];
+	double start;
+	int i;
+
+	for (i = 0; i < PARSE_REPEATS; ++i)
+	{
+		snprintf(prefix, sizeof(prefix), "r%db", cached ? 0 : i); // distinct names defeat cache
+		names = make_names(prefix, ids);
+		interleavings[i] = join_names(names, ids, 4);
+		free(names);
+	}
+
+	c_init();
+	if (cached)
+		c_set_blocks_interleaving(interleavings[0]);
+
+	start = now_ns();
+	for (i = 0; i < PARSE_REPEATS; ++i)
+		c_set_blocks_interleaving(interleavings[i]);
+	result.wall_ns = result.op_ns = now_ns() - start;
+
+	report(&result);
+	c_free();
+	for (i = 0; i < PARSE_REPEATS; ++i)
+		free(interleavings[i]);
+}
+
+/* waits for event nobody publishes, watchdog has to release it */
+static void *watchdog_worker(void *arg)
+{
+	worker_t *worker = arg;
+	double start = now_ns();
+
+	c_wait_event(worker->names[0]);
+	worker->elapsed = now_ns() - start;
+
+	return NULL;
+}
+
+static void bench_watchdog(int threads, int grace)
+{
+	worker_t workers[MAX_THREADS];
+	char (*names)[NAME_SIZE] = make_names("never", threads);
+	result_t result = { "watchdog", threads, 0, threads, 0, 0 };
+	int i;
+
+	c_init();
+	c_set_deadlock_grace(grace);
+
+	for (i = 0; i < threads; ++i)
+		workers[i] = (worker_t) { i, 1, names + i, NULL, 0 };
+	result.wall_ns = run_workers(watchdog_worker, workers, threads, &result.op_ns);
+
+	report(&result);
+	c_free();
+	free(names);
+}
+
+static int selected(char **suites, int suites_count, const char *suite)
+{
+	int i;
+
+	if (suites_count == 0)
+		return 1;
+	for (i = 0; i < suites_count; ++i)
+		if (strcmp(suites[i], suite) == 0)
+			return 1;
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char *suites[16];
+	int suites_count = 0;
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int grace = 1;
+	int threads, ids;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:s:t:n:g:")) != -1)
+		switch (opt)
+		{
+		case 'f':
+			format = optarg;
+			break;
+		case 's':
+			if (suites_count < 16)
+				suites[suites_count++] = optarg;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'n':
+			max_ids = atoi(optarg);
+			break;
+		case 'g':
+			grace = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-f csv|json] [-s suite]... [-t max_threads] [-n max_ids] [-g grace_ms]\n", argv[0]);
+			return 1;
+		}
+	if (max_threads < 1)
+		max_threads = 1;
+	if (max_threads > MAX_THREADS)
+		max_threads = MAX_THREADS;
+
+	registry = make_names("id", max_ids);
+
+	for (threads = 1; threads <= max_threads; threads *= 2)
+		for (ids = 10; ids <= max_ids; ids *= 10)
+		{
+			if (selected(suites, suites_count, "lookup"))
+				bench_lookup(threads, ids);
+			if (selected(suites, suites_count, "handoff") && (threads == 1 || threads % 2 == 0))
+				bench_handoff(threads, ids);
+			if (selected(suites, suites_count, "blocks"))
+				bench_blocks("blocks", threads, ids, 0);
+			if (selected(suites, suites_count, "barrier"))
+				bench_blocks("barrier", threads, ids, 1);
+		}
+
+	for (ids = 10; ids <= max_ids; ids *= 10)
+	{
+		if (selected(suites, suites_count, "parse"))
+			bench_parse(ids, 0);
+		if (selected(suites, suites_count, "parse_cached"))
+			bench_parse(ids, 1);
+	}
+
+	for (threads = 1; threads <= max_threads; threads *= 2)
+		if (selected(suites, suites_count, "watchdog"))
+			bench_watchdog(threads, grace);
+
+	if (strcmp(format, "json") == 0)
+		printf("%s]\n", results_count ? "\n" : "[\n");
+
+	free(registry);
+
+	return 0;
+}
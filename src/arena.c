@@ -0,0 +1,153 @@
+/*
+ * arena.c - Private memory arenas for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+#define ALIGN_UP(x, align) (((x) + (align) - 1) & ~((align) - 1))
+#define CHUNK_HEADER_SIZE ALIGN_UP(sizeof(arena_chunk_t), ARENA_ALIGN)
+#define CHUNK_DATA(chunk) ((char *) (chunk) + CHUNK_HEADER_SIZE)
+
+/* maps chunk able to hold size bytes with given alignment */
+static arena_chunk_t *map_chunk(size_t size, size_t align)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t needed = CHUNK_HEADER_SIZE + size + align;
+	size_t mapped = needed > ARENA_CHUNK_SIZE ? ALIGN_UP(needed, page) : ARENA_CHUNK_SIZE;
+	arena_chunk_t *chunk = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (chunk == MAP_FAILED) // nothing sensible left to do, callers don't expect NULL
+	{
+		fprintf(stderr, "Cannot map %zu bytes for Coconut arena. Aborting...\n", mapped);
+		abort();
+	}
+
+	chunk->next = NULL;
+	chunk->size = mapped - CHUNK_HEADER_SIZE;
+	chunk->used = 0;
+
+	return chunk;
+}
+
+/* returns offset of allocation in chunk, chunk->size if it doesn't fit */
+static size_t fit(const arena_chunk_t *chunk, size_t size, size_t align)
+{
+	uintptr_t data = (uintptr_t) CHUNK_DATA(chunk);
+	size_t offset = ALIGN_UP(data + chunk->used, align) - data;
+
+	return offset <= chunk->size && size <= chunk->size - offset ? offset : chunk->size;
+}
+
+void arena_init(arena_t *arena)
+{
+	arena->chunks = NULL;
+	arena->current = NULL;
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+	return arena_alloc_aligned(arena, size, ARENA_ALIGN);
+}
+
+void *arena_alloc_aligned(arena_t *arena, size_t size, size_t align)
+{
+	arena_chunk_t *chunk = arena->current;
+	arena_chunk_t *mapped;
+	size_t offset;
+	char *memory;
+
+	// skip to first chunk with enough room, the rest of skipped ones waits for reset
+	while (chunk && (offset = fit(chunk, size, align)) == chunk->size)
+		chunk = chunk->next;
+
+	if (!chunk)
+	{
+		mapped = map_chunk(size, align);
+		if (arena->current) // keep unused chunks past current one
+		{
+			mapped->next = arena->current->next;
+			arena->current->next = mapped;
+		}
+		else
+		{
+			mapped->next = arena->chunks;
+			arena->chunks = mapped;
+		}
+		chunk = mapped;
+		offset = fit(chunk, size, align);
+	}
+
+	arena->current = chunk;
+	chunk->used = offset + size;
+	memory = CHUNK_DATA(chunk) + offset;
+	memset(memory, 0, size); // chunks are reused after reset
+
+	return memory;
+}
+
+char *arena_strndup(arena_t *arena, const char *str, size_t length)
+{
+	char *copy = arena_alloc_aligned(arena, length + 1, 1);
+
+	memcpy(copy, str, length);
+
+	return copy;
+}
+
+arena_mark_t arena_mark(const arena_t *arena)
+{
+	arena_mark_t mark = { arena->current, arena->current ? arena->current->used : 0 };
+
+	return mark;
+}
+
+void arena_rewind(arena_t *arena, arena_mark_t mark)
+{
+	arena_chunk_t *chunk;
+
+	if (!mark.chunk)
+	{
+		arena_reset(arena);
+		return;
+	}
+
+	// chunks up to current one were unused at the time of mark
+	for (chunk = mark.chunk; chunk != arena->current; chunk = chunk->next)
+		chunk->next->used = 0;
+	mark.chunk->used = mark.used;
+	arena->current = mark.chunk;
+}
+
+void arena_reset(arena_t *arena)
+{
+	arena_chunk_t *chunk;
+
+	for (chunk = arena->chunks; chunk; chunk = chunk->next)
+		chunk->used = 0;
+	arena->current = arena->chunks;
+}
+
+void arena_free(arena_t *arena)
+{
+	arena_chunk_t *chunk = arena->chunks;
+	arena_chunk_t *next;
+
+	while (chunk)
+	{
+		next = chunk->next;
+		munmap(chunk, chunk->size + CHUNK_HEADER_SIZE);
+		chunk = next;
+	}
+
+	arena_init(arena);
+}
@@ -0,0 +1,100 @@
+/*
+ * arena.h - Private memory arenas for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stddef.h>
+
+/**
+ * Default alignment of arena allocations.
+ */
+#define ARENA_ALIGN 16
+
+/**
+ * Size of regular arena chunk, larger allocations get chunk of their own.
+ */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/**
+ * Chunk of memory mapped for arena, allocations follow the header.
+ * next - next chunk
+ * size - usable size
+ * used - number of bytes handed out
+ */
+typedef struct arena_chunk
+{
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+} arena_chunk_t;
+
+/**
+ * Bump allocator over chunks mapped straight from the system, so Coconut's
+ * objects neither come from nor contend on the tested program's heap.
+ * Objects aren't freed one by one, whole arena is rewound or released at
+ * once. Not thread-safe, every arena is guarded by lock of its owner.
+ * Chunks past current one are always unused.
+ * chunks - list of chunks, in order of use
+ * current - chunk allocations are taken from, NULL if none was mapped yet
+ */
+typedef struct
+{
+	arena_chunk_t *chunks;
+	arena_chunk_t *current;
+} arena_t;
+
+/**
+ * Position in arena, allocations made after it can be rewound.
+ * chunk - current chunk at the time
+ * used - its used bytes at the time
+ */
+typedef struct
+{
+	arena_chunk_t *chunk;
+	size_t used;
+} arena_mark_t;
+
+/**
+ * Initializes empty arena. Nothing is mapped until first allocation.
+ */
+void arena_init(arena_t *arena);
+
+/**
+ * Returns zeroed memory of given size aligned to ARENA_ALIGN.
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * Like arena_alloc but with given alignment, which must be a power of two.
+ */
+void *arena_alloc_aligned(arena_t *arena, size_t size, size_t align);
+
+/**
+ * Returns null-terminated copy of first length characters of str.
+ */
+char *arena_strndup(arena_t *arena, const char *str, size_t length);
+
+/**
+ * Returns current position of arena.
+ */
+arena_mark_t arena_mark(const arena_t *arena);
+
+/**
+ * Takes back all allocations made since mark. Chunks stay mapped.
+ */
+void arena_rewind(arena_t *arena, arena_mark_t mark);
+
+/**
+ * Takes back all allocations at once. Chunks stay mapped for reuse.
+ */
+void arena_reset(arena_t *arena);
+
+/**
+ * Unmaps all chunks of arena, leaving it empty.
+ */
+void arena_free(arena_t *arena);
+
+#endif
@@ -3,274 +3,433 @@
  * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
  */
 
-#include <limits.h>
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "blocks.h"
 #include "coconut.h"
+#include "context.h"
+#include "explore.h"
+#include "stats.h"
 #include "threads.h"
+#include "trace.h"
 #include "utils.h"
 
-block_t blocks_list;
-pthread_mutex_t blocks_list_mutex = PTHREAD_MUTEX_INITIALIZER;
-unsigned long block_counter = 0;
-
-/* should be called with blocks_list_mutex taken */
-static block_t *find_block(const char *id)
+/**
+ * Entry of per-thread stack of begun blocks.
+ * schedule - schedule block belongs to
+ * epoch - epoch of schedule when block was begun
+ * block - begun block, NULL if c_begin_block failed
+ */
+typedef struct
 {
+	schedule_t *schedule;
+	unsigned int epoch;
 	block_t *block;
-	list_t *it;
+} open_block_t;
+
+static __thread open_block_t open_blocks[MAX_NESTED_BLOCKS];
+static __thread unsigned int open_blocks_depth = 0; // may exceed MAX_NESTED_BLOCKS, overflowing entries are dropped
 
-	list_for_each(it, &blocks_list.head)
+static void push_open_block(schedule_t *schedule, block_t *block)
+{
+	if (open_blocks_depth < MAX_NESTED_BLOCKS)
 	{
-		block = list_entry(it, block_t, head);
-		if (strcmp(block->id, id) == 0)
-			return block;
+		open_blocks[open_blocks_depth].schedule = schedule;
+		open_blocks[open_blocks_depth].epoch = schedule ? schedule_epoch(schedule) : 0;
+		open_blocks[open_blocks_depth].block = block;
 	}
-
-	return NULL;
+	++open_blocks_depth;
 }
 
-static block_t *create_add_block(const char* id, char *preds[])
+/* returns false if there is no begun block */
+static bool pop_open_block(open_block_t *entry)
 {
-	int i;
-	block_t *tmp_block;
-	waiting_t *tmp_waiting;
-	block_t *block;
+	if (open_blocks_depth == 0)
+		return false;
 
-	block = find_block(id);
-	if (block)
-	{
-		c_output("Duplicated blocks in interleaving definition, skipping...\n");
-		return NULL;
-	}
+	--open_blocks_depth;
+	if (open_blocks_depth >= MAX_NESTED_BLOCKS)
+		return false;
 
-	block = malloc(sizeof(block_t));
-	// standard fields
-	INIT_LIST_HEAD(&block->head);
-	INIT_LIST_HEAD(&block->preds.head);
-	pthread_cond_init(&block->cond, NULL);
-	pthread_mutex_init(&block->cond_mutex, NULL);
-	block->state = CREATED;
-	block->id = malloc(sizeof(char) * (strlen(id) + 1));
-	strcpy(block->id, id);
+	*entry = open_blocks[open_blocks_depth];
+	return entry->block != NULL;
+}
 
-	// add to list
-	list_add_tail(&block->head, &blocks_list.head);
+unsigned int drop_open_blocks()
+{
+	unsigned int dropped = open_blocks_depth;
 
-	// add preds, if any
-	if (preds == NULL)
-		return block;
+	open_blocks_depth = 0;
 
-	for (i = 0; preds[i]; ++i)
-	{
-		tmp_block = find_block(preds[i]);
-		if (!tmp_block)
-			continue;
+	return dropped;
+}
 
-		tmp_waiting = malloc(sizeof(waiting_t));
-		tmp_waiting->block = tmp_block;
-		list_add_tail(&tmp_waiting->head, &block->preds.head);
-	}
+static block_t *find_block(context_t *context, const char *id)
+{
+	schedule_t *schedule = __atomic_load_n(&context->current_schedule, __ATOMIC_ACQUIRE);
 
-	return block;
+	return schedule ? schedule_find_block(schedule, id) : NULL;
 }
 
-static void free_block(block_t *block)
+void init_blocks(context_t *context)
 {
-	list_t *it, *tmp_it;
-	waiting_t *tmp;
+	arena_init(&context->blocks_arena);
+	arena_init(&context->explored_arena);
+	htable_init(&context->schedules_table, &context->blocks_arena);
+	pthread_mutex_init(&context->blocks_mutex, NULL);
+	context->current_schedule = NULL;
+	context->schedule_deadline = 0;
+	context->schedule_timeout = 0;
+}
 
-	list_for_each_safe(it, tmp_it, &block->preds.head)
-	{
-		tmp = list_entry(it, waiting_t, head);
-		list_del(it);
-		free(tmp);
-	}
-	pthread_cond_destroy(&block->cond);
-	pthread_mutex_destroy(&block->cond_mutex);
-	free(block->id);
-	free(block);
+void free_blocks(context_t *context)
+{
+	// compiled schedules and their cache go away at once
+	arena_free(&context->blocks_arena);
+	arena_free(&context->explored_arena);
+	pthread_mutex_destroy(&context->blocks_mutex);
+	context->current_schedule = NULL;
 }
 
-void free_blocks_list()
+static void finish_block(schedule_t *schedule, block_t *block)
 {
-	list_t *it, *tmp_it;
-	block_t *tmp;
+	unsigned int i = block - schedule->blocks;
+	unsigned int j;
+	block_t *succ;
+
+	if (!mark_block_finished(block)) // already finished
+		return;
 
-	list_for_each_safe(it, tmp_it, &blocks_list.head)
+	// last finishing pred wakes successor up
+	for (j = schedule->succs_offsets[i]; j < schedule->succs_offsets[i + 1]; ++j)
 	{
-		tmp = list_entry(it, block_t, head);
-		list_del(it);
-		free_block(tmp);
+		succ = &schedule->blocks[schedule->succs[j]];
+		if (release_pred(succ))
+			gate_open(&succ->ready, schedule_epoch(schedule));
 	}
 }
 
-static void finish_block(block_t *block)
+/* should be called with blocks_mutex taken */
+void finish_all_blocks(context_t *context)
 {
-	pthread_mutex_lock(&block->cond_mutex);
-	block->state = FINISHED;
-	pthread_cond_broadcast(&block->cond);
-	pthread_mutex_unlock(&block->cond_mutex);
+	schedule_t *schedule = context->current_schedule;
+	unsigned int i;
+
+	if (!schedule)
+		return;
+
+	for (i = 0; i < schedule->blocks_count; ++i)
+		finish_block(schedule, &schedule->blocks[i]);
 }
 
+unsigned long long current_schedule_deadline(context_t *context)
+{
+	return __atomic_load_n(&context->schedule_deadline, __ATOMIC_ACQUIRE);
+}
 
-/* should be called with blocks_list_mutex taken */
-void finish_all_blocks()
+void expire_current_schedule(context_t *context)
 {
-	block_t *block;
-	list_t *it;
+	schedule_t *schedule;
+	unsigned int i;
+	char label[TRACE_LABEL_SIZE + 1];
+
+	pthread_mutex_lock(&context->blocks_mutex);
 
-	list_for_each(it, &blocks_list.head)
+	schedule = context->current_schedule;
+	if (context->schedule_deadline && monotonic_ns() >= context->schedule_deadline)
 	{
-		block = list_entry(it, block_t, head);
-		finish_block(block);
+		__atomic_store_n(&context->schedule_deadline, 0, __ATOMIC_RELEASE);
+
+		// report only if anything was actually left unfinished
+		for (i = 0; i < schedule->blocks_count; ++i)
+			if (block_state(&schedule->blocks[i]) != FINISHED)
+				break;
+		if (i < schedule->blocks_count)
+		{
+			c_output("Interleaving %s exceeded its timeout. Finishing all blocks...\n", schedule->interleaving);
+			// interleaving may be thousands of blocks long, ids file wants it short
+			if (strlen(schedule->interleaving) > TRACE_LABEL_SIZE)
+				snprintf(label, sizeof(label), "%.*s...", TRACE_LABEL_SIZE - 3, schedule->interleaving);
+			else
+				snprintf(label, sizeof(label), "%s", schedule->interleaving);
+			trace_op(TRACE_TIMEOUT, NULL, label);
+			finish_all_blocks(context);
+			__atomic_add_fetch(&context->schedules_expired, 1, __ATOMIC_RELEASE);
+		}
 	}
+
+	pthread_mutex_unlock(&context->blocks_mutex);
 }
 
-void c_set_blocks_interleaving(const char *interleaving)
+bool set_blocks_interleaving(context_t *context, const char *interleaving, unsigned long long timeout_ns, char *error, size_t error_size)
+{
+	schedule_t *schedule;
+	bool had_deadline;
+
+	pthread_mutex_lock(&context->blocks_mutex);
+
+	schedule = htable_find(&context->schedules_table, interleaving);
+	if (schedule) // already compiled, just rewind it
+	{
+		reset_schedule(schedule);
+	}
+	else if ((schedule = compile_schedule(interleaving, &context->blocks_arena, error, error_size)))
+	{
+		schedule->interleaving = htable_insert(&context->schedules_table, interleaving, schedule);
+	}
+	__atomic_store_n(&context->current_schedule, schedule, __ATOMIC_RELEASE);
+
+	had_deadline = context->schedule_deadline != 0;
+	context->schedule_timeout = schedule ? timeout_ns : 0;
+	__atomic_store_n(&context->schedule_deadline, context->schedule_timeout ? monotonic_ns() + timeout_ns : 0, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&context->blocks_mutex);
+
+	if (had_deadline || context->schedule_timeout) // watchdog has to wake up at different time now
+		rearm_watchdog(context);
+
+	return schedule != NULL;
+}
+
+void reset_current_schedule(context_t *context)
 {
-	int i;
-	int j;
-	char **groups = get_tokenized(interleaving, ";");
-	char **prev_elems = NULL;
-	char **elems;
+	schedule_t *schedule;
+	bool had_deadline;
+
+	pthread_mutex_lock(&context->blocks_mutex);
+
+	schedule = context->current_schedule;
+	if (schedule)
+		reset_schedule(schedule);
 
-	if (!running)
+	had_deadline = context->schedule_deadline != 0;
+	__atomic_store_n(&context->schedule_deadline, context->schedule_timeout ? monotonic_ns() + context->schedule_timeout : 0, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&context->blocks_mutex);
+
+	if (had_deadline || context->schedule_timeout)
+		rearm_watchdog(context);
+}
+
+void c_ctx_set_blocks_interleaving(context_t *context, const char *interleaving)
+{
+	if (!context->running)
 		return;
 
-	free_blocks_list();
+	set_blocks_interleaving(context, interleaving, 0, NULL, 0);
+}
 
-	for (i = 0; groups[i]; ++i)
+void c_ctx_set_blocks_interleaving_timeout(context_t *context, const char *interleaving, unsigned long long timeout_ns)
+{
+	if (!context->running)
+		return;
+
+	set_blocks_interleaving(context, interleaving, timeout_ns, NULL, 0);
+}
+
+void set_explored_interleaving(context_t *context, const char *interleaving)
+{
+	schedule_t *schedule = NULL;
+
+	pthread_mutex_lock(&context->blocks_mutex);
+
+	// threads of previous run are joined already, its schedule can be reused as memory
+	arena_reset(&context->explored_arena);
+	if (interleaving && (schedule = compile_schedule(interleaving, &context->explored_arena, NULL, 0)))
 	{
-		elems = get_tokenized(groups[i], ",");
-		for (j = 0; elems[j]; ++j)
-		{
-			if (strlen(elems[j]) == 0)
-				continue;
+		schedule->interleaving = arena_strndup(&context->explored_arena, interleaving, strlen(interleaving));
 
-			pthread_mutex_lock(&blocks_list_mutex);
-			create_add_block(elems[j], prev_elems);
-			pthread_mutex_unlock(&blocks_list_mutex);
-		}
-		free_tokenized(prev_elems);
-		prev_elems = elems;
+		// schedule likely lands where previous one was, its epoch tells them apart
+		schedule->epoch = context->explored_epoch;
+		reset_schedule(schedule);
+		context->explored_epoch = schedule_epoch(schedule);
 	}
-	free_tokenized(prev_elems);
 
-	free_tokenized(groups);
+	__atomic_store_n(&context->current_schedule, schedule, __ATOMIC_RELEASE);
+	__atomic_store_n(&context->schedule_deadline, 0, __ATOMIC_RELEASE);
+	context->schedule_timeout = 0;
+
+	pthread_mutex_unlock(&context->blocks_mutex);
 }
 
-void c_begin_block(const char *id)
+void c_ctx_begin_block(context_t *context, const char *id)
 {
+	schedule_t *schedule;
 	block_t *block;
-	list_t *it;
-	waiting_t *tmp;
+	uint64_t start = 0;
+	bool recorded;
 
-	if (!running)
+	if (!context->running)
 		return;
 
-	pthread_mutex_lock(&blocks_list_mutex);
+	if (__atomic_load_n(&context->recording, __ATOMIC_ACQUIRE)) // learning block sequences, nothing to wait for
+	{
+		record_block(context, id);
+		push_open_block(NULL, NULL);
+		return;
+	}
 
-	block = find_block(id);
+	schedule = __atomic_load_n(&context->current_schedule, __ATOMIC_ACQUIRE);
+	block = schedule ? schedule_find_block(schedule, id) : NULL;
 
-	// basic error handling
+	// basic error handling, failed begin is still pushed to keep c_end_block paired
 	if (!block)
 	{
 		c_output("Block %s to begin not found in interleaving list. Possible malfunctions.\n", id);
-		pthread_mutex_unlock(&blocks_list_mutex);
+		push_open_block(schedule, NULL);
 		return;
 	}
-	if (block->state != CREATED)
+	if (open_blocks_depth >= MAX_NESTED_BLOCKS)
 	{
-		c_output("Block %s already owned by other thread. Possible malfunctions.\n", id);
-		pthread_mutex_unlock(&blocks_list_mutex);
+		c_output("Block %s nested too deeply. Possible malfunctions.\n", id);
+		push_open_block(schedule, NULL);
 		return;
 	}
 
-	// mark owner and block visited
-	block->state = ENABLED;
+	// mark block visited, only one thread can claim it
+	if (!enable_block(block, get_self_thread(context)))
+	{
+		c_output("Block %s already owned by other thread. Possible malfunctions.\n", id);
+		push_open_block(schedule, NULL);
+		return;
+	}
 	block->owner = pthread_self();
-	block->counter = ++block_counter;
-
-	pthread_mutex_unlock(&blocks_list_mutex);
 
-	mark_self_blocked();
+	push_open_block(schedule, block);
+	trace_op(TRACE_BLOCK_BEGIN, &block->trace_id, block->id);
 
-	// wait for each pred
-	list_for_each(it, &block->preds.head)
+	// wait for all preds to finish, thread which won't wait isn't blocked and its wait isn't recorded
+	if (block->preds_count && !gate_is_open(&block->ready, schedule_epoch(schedule)))
 	{
-		tmp = list_entry(it, waiting_t, head);
-		pthread_mutex_lock(&tmp->block->cond_mutex);
-		while (tmp->block->state != FINISHED)
-			pthread_cond_wait(&tmp->block->cond, &tmp->block->cond_mutex);
-		pthread_mutex_unlock(&tmp->block->cond_mutex);
+		mark_self_blocked(context, block, NULL);
+		recorded = stats_enabled;
+		if (recorded)
+			start = monotonic_ns();
+		gate_wait(&block->ready, schedule_epoch(schedule));
+		if (recorded)
+			stats_record(stats_histogram(STATS_BLOCK, &block->stats, block->id), monotonic_ns() - start);
+		mark_self_unblocked(context);
 	}
-	block->state = STARTED;
 
-	mark_self_unblocked();
+	start_block(block);
+	trace_op(TRACE_BLOCK_START, &block->trace_id, block->id);
 }
 
-void c_end_block()
+void c_ctx_end_block(context_t *context)
 {
-	block_t *block = NULL;
-	block_t *tmp;
-	list_t *it;
-	unsigned long min_counter = ULONG_MAX;
+	open_block_t entry;
 
-	if (!running)
+	if (!context->running)
 		return;
 
-	list_for_each(it, &blocks_list.head)
+	if (__atomic_load_n(&context->recording, __ATOMIC_ACQUIRE))
 	{
-		tmp = list_entry(it, block_t, head);
-		if (tmp->state == STARTED && pthread_equal(tmp->owner, pthread_self()) && tmp->counter < min_counter)
-		{
-			min_counter = tmp->counter;
-			block = tmp;
-		}
+		pop_open_block(&entry);
+		return;
 	}
 
-	if (!block)
+	if (!pop_open_block(&entry))
 	{
 		c_output("No begin block for end block. Skipping...\n");
 		return;
 	}
 
-	finish_block(block);
+	// interleaving could be changed meanwhile and block rewound or begun by other thread,
+	// recompiled or rewound schedule may be at the same address, but not in the same epoch
+	if (entry.schedule != __atomic_load_n(&context->current_schedule, __ATOMIC_ACQUIRE) || entry.epoch != schedule_epoch(entry.schedule))
+	{
+		c_output("Block to end belongs to previous interleaving. Skipping...\n");
+		return;
+	}
+	if (!pthread_equal(entry.block->owner, pthread_self()) || block_state(entry.block) == CREATED)
+	{
+		c_output("Block %s to end is not owned by this thread. Skipping...\n", entry.block->id);
+		return;
+	}
+
+	finish_block(entry.schedule, entry.block);
+	trace_op(TRACE_BLOCK_END, &entry.block->trace_id, entry.block->id);
 }
 
-bool c_is_before_block(const char *id)
+bool c_ctx_is_before_block(context_t *context, const char *id)
 {
-	block_t *block = find_block(id);
+	block_t *block = find_block(context, id);
+	BLOCK_STATE state = block ? block_state(block) : CREATED;
 
-	return !block || block->state == CREATED || block->state == ENABLED;
+	return state == CREATED || state == ENABLED;
 }
 
-bool c_is_during_block(const char *id)
+bool c_ctx_is_during_block(context_t *context, const char *id)
 {
-	block_t *block = find_block(id);
+	block_t *block = find_block(context, id);
 
-	return block && block->state == STARTED;
+	return block && block_state(block) == STARTED;
 }
 
-bool c_is_after_block(const char *id)
+bool c_ctx_is_after_block(context_t *context, const char *id)
 {
-	block_t *block = find_block(id);
+	block_t *block = find_block(context, id);
 
-	return block && block->state == FINISHED;
+	return block && block_state(block) == FINISHED;
 }
 
-bool c_begin_block_bool(const char *block, bool cond)
+bool c_ctx_begin_block_bool(context_t *context, const char *block, bool cond)
 {
-	c_begin_block(block);
+	c_ctx_begin_block(context, block);
 	return cond;
 }
 
-bool c_end_block_bool(bool cond)
+bool c_ctx_end_block_bool(context_t *context, bool cond)
 {
-	c_end_block();
+	c_ctx_end_block(context);
 	return cond;
 }
 
+void c_set_blocks_interleaving(const char *interleaving)
+{
+	c_ctx_set_blocks_interleaving(current_context(), interleaving);
+}
+
+void c_set_blocks_interleaving_timeout(const char *interleaving, unsigned long long timeout_ns)
+{
+	c_ctx_set_blocks_interleaving_timeout(current_context(), interleaving, timeout_ns);
+}
+
+void c_begin_block(const char *id)
+{
+	c_ctx_begin_block(current_context(), id);
+}
+
+void c_end_block()
+{
+	c_ctx_end_block(current_context());
+}
+
+bool c_is_before_block(const char *id)
+{
+	return c_ctx_is_before_block(current_context(), id);
+}
+
+bool c_is_during_block(const char *id)
+{
+	return c_ctx_is_during_block(current_context(), id);
+}
+
+bool c_is_after_block(const char *id)
+{
+	return c_ctx_is_after_block(current_context(), id);
+}
+
+bool c_begin_block_bool(const char *block, bool cond)
+{
+	return c_ctx_begin_block_bool(current_context(), block, cond);
+}
+
+bool c_end_block_bool(bool cond)
+{
+	return c_ctx_end_block_bool(current_context(), cond);
+}
@@ -9,74 +9,48 @@
 #include <pthread.h>
 #include <stdbool.h>
 
-#include "list.h"
+#include "schedule.h"
 #include "threads.h"
 
 /**
- * Enum representing state space of block in Coconut
- * CREATED - created by c_set_blocks_interleaving
- * ENABLED - visited by c_begin_block
- * STARTED - started in c_begin_block
- * FINISHED - finished in c_end_block
+ * Maximum depth of blocks nesting within single thread.
  */
-typedef enum
-{
-	CREATED,
-	ENABLED,
-	STARTED,
-	FINISHED,
-} BLOCK_STATE;
+#define MAX_NESTED_BLOCKS 32
 
-struct block;
+struct c_context;
 
 /**
- * Waiting list representation for preceding blocks
- * head - list head
- * block - proceding block
+ * Client function for setting desired interleaving.
  */
-typedef struct
-{
-	list_t head;
-	struct block *block;
-} waiting_t;
+void c_set_blocks_interleaving(const char *interleaving);
 
 /**
- * Block representation in Coconut
- * head - list head
- * owner - owning thread id
- * preds - preceding blocks
- * cond - conditional variable for indicating FINISHED state
- * cond_mutex - mutex for cond conditional variable
- * id - id of block
- * state - current state
- * counter - snapshot of global counter for determining order of c_begin_block
+ * Client function for setting desired interleaving which has to finish
+ * within timeout_ns nanoseconds.
  */
-typedef struct block
-{
-	list_t head;
-	pthread_t owner;
-	waiting_t preds;
-	pthread_cond_t cond;
-	pthread_mutex_t cond_mutex;
-	char *id;
-	BLOCK_STATE state;
-	unsigned long counter;
-} block_t;
+void c_set_blocks_interleaving_timeout(const char *interleaving, unsigned long long timeout_ns);
 
 /**
- * List of all registered blocks byc c_set_blocks_interleaving.
+ * Sets cached interleaving of context which has to finish within
+ * timeout_ns nanoseconds (0 means no limit). Returns false if interleaving
+ * is malformed, its description is then written into error buffer of given
+ * size if it isn't NULL.
  */
-extern block_t blocks_list;
+bool set_blocks_interleaving(struct c_context *context, const char *interleaving, unsigned long long timeout_ns, char *error, size_t error_size);
 
 /**
- * Mutex for blocks_list.
+ * Sets interleaving of context without caching its compiled schedule.
+ * Memory of schedule set by previous call is reused, so its blocks must not
+ * be in use anymore. NULL just drops previous one.
  */
-extern pthread_mutex_t blocks_list_mutex;
+void set_explored_interleaving(struct c_context *context, const char *interleaving);
 
 /**
- * Client function for setting desired interleaving.
+ * Empties stack of blocks begun and not ended by calling thread, so thread
+ * reused for another run doesn't end blocks of previous one. Returns
+ * number of dropped blocks.
  */
-void c_set_blocks_interleaving(const char *interleaving);
+unsigned int drop_open_blocks();
 
 /**
  * Client function for marking block beginning.
@@ -84,7 +58,8 @@ void c_set_blocks_interleaving(const char *interleaving);
 void c_begin_block(const char *id);
 
 /**
- * Client function for marking block ending.
+ * Client function for marking block ending. Ends most recently begun block
+ * of calling thread.
  */
 void c_end_block();
 
@@ -109,14 +84,50 @@ bool c_is_during_block(const char *id);
 bool c_is_after_block(const char *id);
 
 /**
- * Marks all registered blocks as finished.
- * Should be called with blocks_list_mutex taken.
+ * Client functions as above, working in given context.
+ */
+void c_ctx_set_blocks_interleaving(struct c_context *context, const char *interleaving);
+void c_ctx_set_blocks_interleaving_timeout(struct c_context *context, const char *interleaving, unsigned long long timeout_ns);
+void c_ctx_begin_block(struct c_context *context, const char *id);
+void c_ctx_end_block(struct c_context *context);
+bool c_ctx_is_before_block(struct c_context *context, const char *id);
+bool c_ctx_is_during_block(struct c_context *context, const char *id);
+bool c_ctx_is_after_block(struct c_context *context, const char *id);
+bool c_ctx_begin_block_bool(struct c_context *context, const char *block, bool cond);
+bool c_ctx_end_block_bool(struct c_context *context, bool cond);
+
+/**
+ * Initializes context's schedules cache.
+ */
+void init_blocks(struct c_context *context);
+
+/**
+ * Marks all blocks of context's current schedule as finished.
+ * Should be called with blocks_mutex taken.
+ */
+void finish_all_blocks(struct c_context *context);
+
+/**
+ * Returns monotonic time in nanoseconds at which context's current schedule
+ * times out, 0 if it has no timeout. Lock-free.
+ */
+unsigned long long current_schedule_deadline(struct c_context *context);
+
+/**
+ * Finishes all blocks of context's current schedule if its timeout has
+ * passed.
+ */
+void expire_current_schedule(struct c_context *context);
+
+/**
+ * Rewinds context's current schedule, if any, in constant time and restarts
+ * its timeout. Nobody may be inside its blocks meanwhile.
  */
-void finish_all_blocks();
+void reset_current_schedule(struct c_context *context);
 
 /**
- * Memory freeing function for blocks in blocks_list.
+ * Memory freeing function for all schedules compiled in context.
  */
-void free_blocks_list();
+void free_blocks(struct c_context *context);
 
 #endif
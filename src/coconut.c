@@ -3,122 +3,423 @@
  * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
+#include <time.h>
 
 #include "blocks.h"
 #include "coconut.h"
+#include "context.h"
+#include "deadlock.h"
 #include "events.h"
+#include "explore.h"
+#include "output.h"
+#include "stats.h"
 #include "threads.h"
+#include "trace.h"
+#include "utils.h"
+
+#define DEFAULT_WATCHDOG_TICK 1000000000ULL // in nanoseconds
+#define DEFAULT_DEADLOCK_GRACE 50 // in milliseconds
 
-pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_t watchdog_thread;
-unsigned int watchdog_tick = 1;
+context_t default_context = { .watchdog_tick = DEFAULT_WATCHDOG_TICK, .deadlock_grace = DEFAULT_DEADLOCK_GRACE };
 bool running = false;
+static pthread_mutex_t contexts_mutex = PTHREAD_MUTEX_INITIALIZER; // serializes starting and stopping of shared services
+static unsigned int running_contexts = 0;
+static unsigned long contexts_generation = 0; // source of unique generations of contexts
+static __thread context_t *self_context = NULL; // NULL -> default context
+
+context_t *current_context()
+{
+	return self_context ? self_context : &default_context;
+}
 
-void c_output(const char *format, ...)
+void notify_watchdog(context_t *context)
 {
-	if (!running)
+	pthread_mutex_lock(&context->watchdog_mutex);
+	context->watchdog_notified = true;
+	pthread_cond_signal(&context->watchdog_cond);
+	pthread_mutex_unlock(&context->watchdog_mutex);
+}
+
+void rearm_watchdog(context_t *context)
+{
+	if (!context->running) // watchdog not created yet
 		return;
 
-	pthread_mutex_lock(&output_mutex);
-	va_list args;
-	va_start(args, format);
-	vfprintf(stderr, format, args);
-	va_end(args);
-	pthread_mutex_unlock(&output_mutex);
+	pthread_mutex_lock(&context->watchdog_mutex);
+	context->watchdog_rearmed = true;
+	pthread_cond_signal(&context->watchdog_cond);
+	pthread_mutex_unlock(&context->watchdog_mutex);
+}
+
+static unsigned long locked_progress_sum(context_t *context)
+{
+	unsigned long sum;
+
+	pthread_mutex_lock(&context->threads_list_mutex);
+	sum = progress_sum(context);
+	pthread_mutex_unlock(&context->threads_list_mutex);
+
+	return sum;
+}
+
+/* sleeps for ms milliseconds, then checks if all live threads stayed blocked */
+static bool confirm_deadlock(context_t *context, unsigned int ms)
+{
+	unsigned long progress = locked_progress_sum(context);
+	struct timespec grace = { ms / 1000, (ms % 1000) * 1000000L };
+
+	nanosleep(&grace, NULL);
+
+	// notification may be stale, all threads could have exited meanwhile
+	return !check_liveness(context) && locked_progress_sum(context) == progress;
+}
+
+/* waits until monotonic time wake (in ns), notification or rearm, returns true if notified */
+static bool watchdog_sleep(context_t *context, unsigned long long wake)
+{
+	struct timespec deadline = { wake / 1000000000ULL, wake % 1000000000ULL };
+	bool notified;
+
+	pthread_mutex_lock(&context->watchdog_mutex);
+	while (context->running && !context->watchdog_notified && !context->watchdog_rearmed)
+		if (pthread_cond_timedwait(&context->watchdog_cond, &context->watchdog_mutex, &deadline) == ETIMEDOUT)
+			break;
+	notified = context->watchdog_notified;
+	context->watchdog_notified = false;
+	context->watchdog_rearmed = false;
+	pthread_mutex_unlock(&context->watchdog_mutex);
+
+	return notified;
 }
 
-static void *watchdog(void *dummy)
+static void *watchdog(void *arg)
 {
-	unsigned long last_blocked_counter = blocked_counter - 1;
+	context_t *context = arg;
+	unsigned long last_progress = locked_progress_sum(context) - 1;
+	unsigned long long next_tick = monotonic_ns() + context->watchdog_tick;
+	unsigned long long wake;
+	unsigned long long deadline;
+	bool notified;
 	bool terminate;
 
-	while (running)
+	while (context->running)
 	{
+		// tick might have been shortened meanwhile
+		wake = monotonic_ns() + context->watchdog_tick;
+		if (wake < next_tick)
+			next_tick = wake;
+
+		// wake up earlier if current schedule times out before next tick
+		wake = next_tick;
+		deadline = current_schedule_deadline(context);
+		if (deadline && deadline < wake)
+			wake = deadline;
+
+		notified = watchdog_sleep(context, wake);
+		if (!context->running)
+			break;
+
+		expire_current_schedule(context);
+
+		// last runnable thread blocked -> deadlock unless something changes within grace period
+		if (notified)
+		{
+			if (context->running && confirm_deadlock(context, context->deadlock_grace))
+				resolve_deadlock(context);
+			continue;
+		}
+
+		if (monotonic_ns() < next_tick) // woken up for timeout or rearm only
+			continue;
+		next_tick = monotonic_ns() + context->watchdog_tick;
+
+		// periodic check is a safety net for missed notifications
 		terminate = true;
 
-		pthread_mutex_lock(&threads_list_mutex);
+		pthread_mutex_lock(&context->threads_list_mutex);
 
-		if (terminate && list_empty(&threads_list.head)) // if empty - nothing happened -> ok
+		if (terminate && list_empty(&context->threads_list.head)) // if empty - nothing happened -> ok
 			terminate = false;
 
-		if (terminate && last_blocked_counter != blocked_counter) // if counter changed, there was change in state -> ok
+		if (terminate && last_progress != progress_sum(context)) // if progress was made, there was change in state -> ok
 			terminate = false;
 
-		if (terminate && check_liveness()) // if still uncertain, check liveness
+		if (terminate && check_liveness(context)) // if still uncertain, check liveness
 				terminate = false;
 
-		pthread_mutex_unlock(&threads_list_mutex);
+		pthread_mutex_unlock(&context->threads_list_mutex);
 
-		if (terminate) // finally -> terminate
-		{
-			c_output("Deadlock detected, fixed interleaving is probably impossible. Perhaps synchronization is correct or you should adjust watchdog tick with $C_WATCHDOG_TICK. Publishing all events, finishing all blocks...\n");
+		if (terminate && context->running) // finally -> terminate
+			resolve_deadlock(context);
 
-			pthread_mutex_lock(&events_list_mutex);
-			publish_all_events();
-			pthread_mutex_unlock(&events_list_mutex);
+		last_progress = locked_progress_sum(context);
+	}
 
-			pthread_mutex_lock(&blocks_list_mutex);
-			finish_all_blocks();
-			pthread_mutex_unlock(&blocks_list_mutex);
-		}
+	return NULL;
+}
 
-		last_blocked_counter = blocked_counter;
-		sleep(watchdog_tick);
+void c_ctx_set_watchdog_tick_ns(context_t *context, unsigned long long tick_ns)
+{
+	if (!tick_ns)
+	{
+		c_output("Watchdog tick has to be positive. Skipping...\n");
+		return;
 	}
 
-	return NULL;
+	context->watchdog_tick = tick_ns;
+	rearm_watchdog(context);
+}
+
+void c_ctx_set_watchdog_tick(context_t *context, unsigned int tick)
+{
+	c_ctx_set_watchdog_tick_ns(context, tick * 1000000000ULL);
+}
+
+void c_ctx_set_deadlock_grace(context_t *context, unsigned int ms)
+{
+	context->deadlock_grace = ms;
+}
+
+void c_set_watchdog_tick_ns(unsigned long long tick_ns)
+{
+	c_ctx_set_watchdog_tick_ns(current_context(), tick_ns);
 }
 
 void c_set_watchdog_tick(unsigned int tick)
 {
-	watchdog_tick = tick;
+	c_ctx_set_watchdog_tick(current_context(), tick);
 }
 
-void c_init()
+void c_set_deadlock_grace(unsigned int ms)
+{
+	c_ctx_set_deadlock_grace(current_context(), ms);
+}
+
+void capture_assertion(context_t *context, char *buffer, size_t size)
+{
+	context->assertion_buffer = buffer;
+	context->assertion_buffer_size = size;
+	__atomic_store_n(&context->assertion_captured, false, __ATOMIC_RELEASE);
+}
+
+static void assertion_failed(context_t *context, const char *file, int line, const char *format, va_list args)
+{
+	char where[4096];
+	va_list args_copy;
+
+	__atomic_add_fetch(&context->assertions_failed, 1, __ATOMIC_ACQ_REL);
+	if (context->assertion_buffer && !__atomic_exchange_n(&context->assertion_captured, true, __ATOMIC_ACQ_REL)) // first one only, so no races on buffer
+	{
+		va_copy(args_copy, args);
+		vsnprintf(context->assertion_buffer, context->assertion_buffer_size, format, args_copy);
+		va_end(args_copy);
+	}
+
+	if (tracing)
+	{
+		snprintf(where, sizeof(where), "%s:%d", file, line);
+		trace_op(TRACE_ASSERT, NULL, where);
+	}
+
+	voutput(format, args);
+	if (running)
+		flush_output(); // tested program may crash right after failed assertion
+}
+
+void c_ctx_assert_failed(context_t *context, const char *file, int line, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	assertion_failed(context, file, line, format, args);
+	va_end(args);
+}
+
+void c_assert_failed(const char *file, int line, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	assertion_failed(current_context(), file, line, format, args);
+	va_end(args);
+}
+
+/* output, trace, stats and footprints are shared, first running context starts them */
+static void start_services()
+{
+	pthread_mutex_lock(&contexts_mutex);
+	if (running_contexts++ == 0)
+	{
+		// mark coconut running
+		running = true;
+
+		// start buffering output and recording trace if requested
+		init_output();
+		init_trace();
+		init_stats();
+		init_explore();
+	}
+	pthread_mutex_unlock(&contexts_mutex);
+}
+
+/* last running context stops shared services */
+static void stop_services()
+{
+	pthread_mutex_lock(&contexts_mutex);
+	if (--running_contexts == 0)
+	{
+		dump_stats(); // while output is still running
+
+		running = false; // stop running additional threads
+
+		free_output(); // flush whatever is left
+		free_trace();
+		free_explore();
+		free_stats();
+	}
+	pthread_mutex_unlock(&contexts_mutex);
+}
+
+static void init_context(context_t *context)
 {
 	char *disable_str;
 	int disable_val;
 	char *watchdog_tick_str;
 	unsigned int new_watchdog_tick;
+	unsigned long long new_watchdog_tick_ns;
+	char *deadlock_grace_str;
+	unsigned int new_deadlock_grace;
+	pthread_condattr_t cond_attr;
 
 	disable_str = getenv("C_DISABLE");
 	if (disable_str && sscanf(disable_str, "%d", &disable_val) == 1)
 		if (disable_val)
 			return; // disabling requested, so quitting
 
-	// mark coconut running
-	running = true;
+	// watchdog's timeouts are measured on monotonic clock
+	pthread_mutex_init(&context->watchdog_mutex, NULL);
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&context->watchdog_cond, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+	context->watchdog_notified = false;
+	context->watchdog_rearmed = false;
+	context->generation = __atomic_add_fetch(&contexts_generation, 1, __ATOMIC_ACQ_REL);
 
-	// init static list heads
-	INIT_LIST_HEAD(&events_list.head);
-	INIT_LIST_HEAD(&threads_list.head);
-	INIT_LIST_HEAD(&blocks_list.head);
+	start_services();
+
+	// mark context running
+	context->running = true;
+
+	// init list heads
+	init_events_list(context);
+	init_threads_list(context);
+	init_blocks(context);
+	init_pool(context);
+	context->recording = false;
+	context->recorded = NULL;
 
 	// read watchdog tick duration
 	watchdog_tick_str = getenv("C_WATCHDOG_TICK");
 	if (watchdog_tick_str && sscanf(watchdog_tick_str, "%u", &new_watchdog_tick) == 1)
-		c_set_watchdog_tick(new_watchdog_tick);
+		c_ctx_set_watchdog_tick(context, new_watchdog_tick);
+	watchdog_tick_str = getenv("C_WATCHDOG_TICK_NS");
+	if (watchdog_tick_str && sscanf(watchdog_tick_str, "%llu", &new_watchdog_tick_ns) == 1)
+		c_ctx_set_watchdog_tick_ns(context, new_watchdog_tick_ns);
+
+	// read deadlock grace period
+	deadlock_grace_str = getenv("C_DEADLOCK_GRACE");
+	if (deadlock_grace_str && sscanf(deadlock_grace_str, "%u", &new_deadlock_grace) == 1)
+		c_ctx_set_deadlock_grace(context, new_deadlock_grace);
 
 	// create watchdog
-	pthread_create(&watchdog_thread, NULL, watchdog, NULL);
+	pthread_create(&context->watchdog_thread, NULL, watchdog, context);
 }
 
-void c_free()
+static void free_context(context_t *context)
 {
-	if (!running)
+	if (!context->running)
 		return;
 
-	running = false; // stop running additional threads
+	free_pool(context); // workers are parked between runs
 
-	pthread_join(watchdog_thread, NULL); // wait for watchdog to terminate
+	context->running = false; // stop running additional threads
+
+	notify_watchdog(context); // cut watchdog's sleep short
+	pthread_join(context->watchdog_thread, NULL); // wait for watchdog to terminate
+	pthread_cond_destroy(&context->watchdog_cond);
+	pthread_mutex_destroy(&context->watchdog_mutex);
 
 	// memory freeing
-	free_threads_list();
-	free_events_list();
-	free_blocks_list();
+	free_threads_list(context);
+	free_events_list(context);
+	free_blocks(context);
+
+	stop_services();
+}
+
+void c_init()
+{
+	init_context(&default_context);
+}
+
+void c_free()
+{
+	free_context(&default_context);
+}
+
+context_t *c_ctx_init()
+{
+	size_t size = (sizeof(context_t) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE; // aligned_alloc wants multiple of alignment
+	context_t *context = aligned_alloc(CACHE_LINE_SIZE, size);
+
+	if (!context)
+		return NULL;
+
+	memset(context, 0, size);
+	context->allocated = true;
+	context->watchdog_tick = DEFAULT_WATCHDOG_TICK;
+	context->deadlock_grace = DEFAULT_DEADLOCK_GRACE;
+	init_context(context);
+
+	return context;
+}
+
+void c_ctx_free(context_t *context)
+{
+	free_context(context);
+	if (context->allocated)
+		free(context);
+}
+
+void c_ctx_reset(context_t *context)
+{
+	if (!context->running)
+		return;
+
+	reset_all_events(context);
+	reset_current_schedule(context);
+}
+
+void c_reset()
+{
+	c_ctx_reset(current_context());
+}
+
+void c_set_context(context_t *context)
+{
+	self_context = context;
+}
+
+context_t *c_get_context()
+{
+	return current_context();
 }
 
@@ -7,14 +7,49 @@
 #define __COCONUT_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+struct c_context;
 
 /**
- * Global variable indicating if Coconut is setup and running.
+ * Global variable indicating if Coconut is setup and running, i.e. if any
+ * context is running. Output, trace and statistics work while it's true.
  */
 extern bool running;
 
 /**
- * Client function for outputting info on stderr.
+ * Client functions setting up and tearing down Coconut.
+ */
+void c_init();
+void c_free();
+
+/**
+ * Client function resetting current context between test runs, see
+ * c_ctx_reset.
+ */
+void c_reset();
+
+/**
+ * Makes first failed assertion message of context be also written,
+ * truncated, into buffer of given size. Used by parallel runs to pass it to
+ * parent process.
+ */
+void capture_assertion(struct c_context *context, char *buffer, size_t size);
+
+/**
+ * Wakes context's watchdog up to check for deadlock immediately.
+ */
+void notify_watchdog(struct c_context *context);
+
+/**
+ * Wakes context's watchdog up to recompute its wake up time, e.g. after
+ * timeout of current schedule has changed.
+ */
+void rearm_watchdog(struct c_context *context);
+
+/**
+ * Client function for outputting info on stderr. Buffered per thread,
+ * see output.h.
  */
 void c_output(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
 
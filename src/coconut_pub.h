@@ -4,12 +4,73 @@
  * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
  */
 
-#ifndef __COCONUT_H
-#define __COCONUT_H
+#ifndef __COCONUT_PUB_H
+#define __COCONUT_PUB_H
+
+#include <stdbool.h>
+
+/**
+ * Blocked time statistics of block or event.
+ * count - number of waits
+ * total - sum of blocked times
+ * p50, p99 - median and 99th percentile of blocked time
+ * max - maximum blocked time
+ * All times are in nanoseconds, percentiles are accurate within 1/16.
+ */
+typedef struct c_stats
+{
+	unsigned long long count;
+	unsigned long long total;
+	unsigned long long p50;
+	unsigned long long p99;
+	unsigned long long max;
+} c_stats_t;
+
+/**
+ * Type of tested thread routine, just as in pthread_create.
+ */
+typedef void *(*c_thread_routine_t)(void *);
+
+/**
+ * Size of assertion message kept in c_result_t.
+ */
+#define C_RESULT_MESSAGE_SIZE 256
+
+/**
+ * Result of running single interleaving by c_run_parallel.
+ * index - position of interleaving in given list or generated sequence
+ * passed - true if test ended normally without failed assertions
+ * timed_out - true if test got killed for exceeding its timeout
+ * signal - signal which killed test process, 0 if none
+ * assertions_failed - number of assertions failed
+ * duration_ns - running time of test body, or of whole process if it died
+ * message - first failed assertion message (truncated), empty if none
+ */
+typedef struct c_result
+{
+	unsigned long index;
+	bool passed;
+	bool timed_out;
+	int signal;
+	unsigned long assertions_failed;
+	unsigned long long duration_ns;
+	char message[C_RESULT_MESSAGE_SIZE];
+} c_result_t;
+
+/**
+ * Generator of interleavings for c_run_parallel, returns next one or NULL if
+ * there are no more. Returned string has to stay valid until next call only.
+ */
+typedef const char *(*c_interleaving_generator_t)(void *state);
+
+/**
+ * Independent Coconut context, see c_ctx_init.
+ */
+typedef struct c_context c_context_t;
 
 #ifndef NCOCONUT
 
-#include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -19,6 +80,13 @@ extern "C"
 /**
  * Initializing function.
  * Should be called before any other Coconut functions.
+ * If environmental variable C_TRACE is set, binary trace of blocks, events,
+ * watchdog interventions and failed assertions is recorded into files
+ * prefixed with its value (C_TRACE_SIZE records per thread at most, 65536
+ * by default). Use tools/trace_decode to read it.
+ * If environmental variable C_TIMELINE is set, the same points are buffered
+ * in memory and written by c_free into file it names as Chrome Trace Event
+ * JSON, viewable in chrome://tracing or Perfetto UI.
  */
 void c_init();
 
@@ -29,11 +97,88 @@ void c_init();
 void c_free();
 
 /**
- * Sets watchdog tick duration just as environmental variable C_WATCHDOG_TICK.
- * Takes precedence over C_WATCHDOG_TICK variable.
+ * Brings current context back to the state right after c_init and setting
+ * its current interleaving (with timeout restarted): all events become
+ * unpublished and all blocks not begun. Takes constant time, nothing is freed
+ * or allocated and the watchdog keeps running, so it's much cheaper than
+ * c_free followed by c_init between repeated runs of a test. Threads of the
+ * previous run must be done with events and blocks.
+ */
+void c_reset();
+
+/**
+ * Sets up new context, independent of the default one set up by c_init and
+ * of any other. Each context has its own events, blocks, interleaving,
+ * registered threads, failed assertions and watchdog with its own policy,
+ * so unrelated tests may run in different contexts at the same time.
+ * Output, trace, statistics and declared footprints are shared. Functions
+ * not taking context work in current context of calling thread, which is
+ * the default one unless changed by c_set_context. Every c_X function has
+ * c_ctx_X variant taking context as first argument. Returns NULL if
+ * context couldn't be allocated.
+ */
+c_context_t *c_ctx_init();
+
+/**
+ * Tears context down and frees it. Its threads shouldn't use it anymore.
+ */
+void c_ctx_free(c_context_t *context);
+
+/**
+ * Makes context current for calling thread, NULL means default context.
+ * New threads start in the default context.
+ */
+void c_set_context(c_context_t *context);
+
+/**
+ * Returns current context of calling thread.
+ */
+c_context_t *c_get_context();
+
+void c_ctx_reset(c_context_t *context);
+void c_ctx_set_watchdog_tick(c_context_t *context, unsigned int tick);
+void c_ctx_set_watchdog_tick_ns(c_context_t *context, unsigned long long tick_ns);
+void c_ctx_set_deadlock_grace(c_context_t *context, unsigned int ms);
+void c_ctx_wait_event(c_context_t *context, const char *event);
+void c_ctx_publish_event(c_context_t *context, const char *event);
+bool c_ctx_is_event_published(c_context_t *context, const char *event);
+void c_ctx_set_blocks_interleaving(c_context_t *context, const char *interleaving);
+void c_ctx_set_blocks_interleaving_timeout(c_context_t *context, const char *interleaving, unsigned long long timeout_ns);
+void c_ctx_begin_block(c_context_t *context, const char *block);
+void c_ctx_end_block(c_context_t *context);
+bool c_ctx_is_before_block(c_context_t *context, const char *block);
+bool c_ctx_is_during_block(c_context_t *context, const char *block);
+bool c_ctx_is_after_block(c_context_t *context, const char *block);
+bool c_ctx_begin_block_bool(c_context_t *context, const char *block, bool cond);
+bool c_ctx_end_block_bool(c_context_t *context, bool cond);
+c_result_t c_ctx_run_schedule(c_context_t *context, c_thread_routine_t *routines, void **args, unsigned int count, const char *interleaving);
+void c_ctx_set_schedule_timeout(c_context_t *context, unsigned long long timeout_ns);
+unsigned long c_ctx_explore(c_context_t *context, void (*setup)(), c_thread_routine_t *routines, void **args, unsigned int count);
+void c_ctx_assert_failed(c_context_t *context, const char *file, int line, const char *format, ...) __attribute__ ((format (printf, 4, 5)));
+
+/**
+ * Sets watchdog tick duration in seconds just as environmental variable
+ * C_WATCHDOG_TICK. Takes precedence over C_WATCHDOG_TICK variable.
  */
 void c_set_watchdog_tick(unsigned int tick);
 
+/**
+ * Sets watchdog tick duration in nanoseconds just as environmental variable
+ * C_WATCHDOG_TICK_NS, which overrides C_WATCHDOG_TICK. Takes effect
+ * immediately, even if watchdog is in the middle of longer tick.
+ * Zero is rejected.
+ */
+void c_set_watchdog_tick_ns(unsigned long long tick_ns);
+
+/**
+ * Sets deadlock grace period in milliseconds just as environmental variable
+ * C_DEADLOCK_GRACE. Takes precedence over C_DEADLOCK_GRACE variable.
+ * When last registered thread blocks on Coconut primitive, deadlock is
+ * resolved if nothing changes within grace period. Should be long enough
+ * for threads blocked outside of Coconut to make progress. Defaults to 50.
+ */
+void c_set_deadlock_grace(unsigned int ms);
+
 /**
  * Blocks calling thread until event is published.
  */
@@ -52,16 +197,28 @@ bool c_is_event_published(const char *event);
 /**
  * Sets desired interleaving of blocks. Sequence that may run concurrently
  * should be delimited with ',', sequences for sequential execution with ';'.
+ * Malformed interleaving (empty block name, dangling delimiter, duplicated
+ * block) is reported with position of error and leaves no interleaving set.
  */
 void c_set_blocks_interleaving(const char *interleaving);
 
+/**
+ * Sets desired interleaving just as c_set_blocks_interleaving, but gives it
+ * timeout_ns nanoseconds to finish. If some of its blocks are still
+ * unfinished by then, it is reported and all its blocks are finished so that
+ * waiting threads may proceed. Timeout of 0 means no timeout. Setting next
+ * interleaving cancels the timeout.
+ */
+void c_set_blocks_interleaving_timeout(const char *interleaving, unsigned long long timeout_ns);
+
 /**
  * Marks beginning of block.
  */
 void c_begin_block(const char *block);
 
 /**
- * Marks end of block.
+ * Marks end of block. Ends most recently begun block of calling thread,
+ * so blocks may be nested.
  */
 void c_end_block();
 
@@ -99,11 +256,130 @@ bool c_end_block_bool(bool cond);
  */
 #define c_cond_block(COND, BLOCK) (c_begin_block_bool(BLOCK, false) || c_end_block_bool(COND))
 
+/**
+ * Explores all interleavings of blocks of count routines. First routines
+ * are run once just to record sequence of blocks each of them begins (ids
+ * have to be unique). Then they are run once per every linearization of
+ * those sequences consistent with program order of each routine, generated
+ * one by one. Every run starts with calling setup (may be NULL), which
+ * should reset tested state, after all events are made unpublished again.
+ * Routine i gets args[i] as argument (args may be NULL).
+ * Outputs interleavings which failed any assertion and returns their number.
+ * If any recorded block has footprint declared, only one interleaving per
+ * class of equivalent ones is run - swapping adjacent blocks of different
+ * routines whose footprints don't conflict gives equivalent interleaving.
+ */
+unsigned long c_explore(void (*setup)(), c_thread_routine_t *routines, void **args, unsigned int count);
+
+/**
+ * Declares resources block reads and writes, as comma-separated lists of
+ * names (either may be NULL). Two blocks conflict if one of them writes
+ * resource the other one reads or writes. Blocks with no footprint declared
+ * conflict with every other block. Declarations accumulate.
+ */
+void c_block_footprint(const char *block, const char *reads, const char *writes);
+
+/**
+ * Like c_block_footprint but declares size bytes starting at address, which
+ * conflict with any overlapping range written by other block.
+ */
+void c_block_range(const char *block, const void *address, size_t size, bool write);
+
+/**
+ * Sets number of processes c_run_parallel runs at once. Defaults to 0, which
+ * means number of online cores.
+ */
+void c_set_parallel_jobs(unsigned int jobs);
+
+/**
+ * Sets time limit of single interleaving run by c_run_parallel, in seconds.
+ * Process exceeding it gets killed and reported as timed out. Defaults to 60,
+ * 0 means no limit.
+ */
+void c_set_parallel_timeout(unsigned int seconds);
+
+/**
+ * Runs test(arg) once per interleaving returned by generator(state), each
+ * in its own forked process, keeping all processes of the pool busy. Every
+ * process calls c_init, sets the interleaving, runs test (which has to join
+ * threads it created) and calls c_free, so it must be called while Coconut
+ * is not running. Crash or hang of one interleaving doesn't affect others.
+ * Processes run in their own process group and only they are waited for,
+ * other children of the program are left alone. Malformed or empty
+ * interleaving fails without running test. Result of i-th interleaving
+ * is stored in results[i] if i < capacity (results may be NULL). Outputs
+ * interleavings which failed and returns their number.
+ */
+unsigned long c_run_parallel(void (*test)(void *), void *arg, c_interleaving_generator_t generator, void *state, c_result_t *results, unsigned long capacity);
+
+/**
+ * Like c_run_parallel, but runs count interleavings from the list. Results
+ * (may be NULL) has to hold count entries.
+ */
+unsigned long c_run_interleavings(void (*test)(void *), void *arg, const char **interleavings, unsigned long count, c_result_t *results);
+
+/**
+ * Runs count routines, routine i with args[i] (args may be NULL), under
+ * given interleaving and returns result of the run. Routines run on threads
+ * of a pool kept by current context, which stay parked between runs, so
+ * running many schedules costs no thread creation. Events are made
+ * unpublished and interleaving is rewound before the run, nothing is freed.
+ * Index of result counts runs of the context. Malformed or empty
+ * interleaving fails the run without running routines, its error is in
+ * result message. Run which exceeded timeout set by c_set_schedule_timeout
+ * has its blocks finished by watchdog and fails as timed out.
+ */
+c_result_t c_run_schedule(c_thread_routine_t *routines, void **args, unsigned int count, const char *interleaving);
+
+/**
+ * Sets time limit of single c_run_schedule run in nanoseconds, 0 (default)
+ * means no limit.
+ */
+void c_set_schedule_timeout(unsigned long long timeout_ns);
+
+/**
+ * Turns recording of blocked time stats on or off. Recording is off unless
+ * this is called or environmental variable C_STATS is set to non-zero, so
+ * waits don't pay for it by default.
+ */
+void c_enable_stats(bool enable);
+
+/**
+ * Fills stats of time threads spent in c_begin_block waiting for preceding
+ * blocks. Blocks without preds are never waited for and aren't counted.
+ * Returns false if nobody waited for preds of such block yet.
+ */
+bool c_block_stats(const char *block, c_stats_t *stats);
+
+/**
+ * Fills stats of time threads spent in c_wait_event. Waits for already
+ * published event return at once and aren't counted. Returns false if
+ * nobody waited for such event yet.
+ */
+bool c_event_stats(const char *event, c_stats_t *stats);
+
+/**
+ * Outputs stats of all blocks and events. Called by c_free if environmental
+ * variable C_STATS is set to non-zero.
+ */
+void c_print_stats();
+
 /**
  * Function for safe outputting to stderr.
+ * Doesn't block other threads: message is formatted into calling thread's
+ * buffer and written out by background flusher shortly after, in order of
+ * c_output calls across all threads. Remaining messages are written by
+ * c_free or at exit. Failed assertions and deadlock reports are written
+ * right away, so they survive a crash that follows them.
  */
 void c_output(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
 
+/**
+ * Reports failed assertion at file:line, used by c_assert_* macros.
+ * Outputs formatted message and records failure in trace.
+ */
+void c_assert_failed(const char *file, int line, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
+
 /**
  * c_output wrapper with beautification
  */
@@ -112,7 +388,7 @@ void c_output(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
 /**
  * Asserts that COND is true. Prints passed message otherwise.
  */
-#define c_assert_true(COND, FMT, ...) do { if (!(COND)) { c_output("[%s:%s:%d]: Assert failed: " FMT "\n", __FILE__, __PRETTY_FUNCTION__, __LINE__, ##__VA_ARGS__); } } while (0)
+#define c_assert_true(COND, FMT, ...) do { if (!(COND)) { c_assert_failed(__FILE__, __LINE__, "[%s:%s:%d]: Assert failed: " FMT "\n", __FILE__, __PRETTY_FUNCTION__, __LINE__, ##__VA_ARGS__); } } while (0)
 /**
  * Asserts that COND is false. Prints passed message otherwise.
  */
@@ -138,12 +414,59 @@ void c_output(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
  */
 #define c_assert_after_block(BLOCK, FMT, ...) do { if (!c_is_after_block(BLOCK)) c_assert_true(0, FMT, ##__VA_ARGS__); } while (0)
 
+#ifdef __cplusplus
+}
+#endif
+
 #else
 
 #define c_init() do {} while(0)
 #define c_free() do {} while(0)
+#define c_reset() do {} while(0)
+
+#define c_ctx_init() (NULL)
+#define c_ctx_free(x) do {} while(0)
+#define c_ctx_reset(x) do {} while(0)
+#define c_set_context(x) do {} while(0)
+#define c_get_context() (NULL)
+#define c_ctx_set_watchdog_tick(c, x) do {} while(0)
+#define c_ctx_set_watchdog_tick_ns(c, x) do {} while(0)
+#define c_ctx_set_deadlock_grace(c, x) do {} while(0)
+#define c_ctx_wait_event(c, x) do {} while(0)
+#define c_ctx_publish_event(c, x) do {} while(0)
+#define c_ctx_is_event_published(c, x) do {} while(0)
+#define c_ctx_set_blocks_interleaving(c, x) do {} while(0)
+#define c_ctx_set_blocks_interleaving_timeout(c, x, y) do {} while(0)
+#define c_ctx_begin_block(c, x) do {} while(0)
+#define c_ctx_end_block(c) do {} while(0)
+#define c_ctx_is_before_block(c, x) do {} while(0)
+#define c_ctx_is_during_block(c, x) do {} while(0)
+#define c_ctx_is_after_block(c, x) do {} while(0)
+#define c_ctx_begin_block_bool(c, x, y) (y)
+#define c_ctx_end_block_bool(c, x) (x)
+#define c_ctx_explore(c, setup, routines, args, count) (0)
+#define c_ctx_assert_failed(c, file, line, ...) do {} while(0)
 
 #define c_set_watchdog_tick(x) do {} while (0)
+#define c_set_watchdog_tick_ns(x) do {} while (0)
+#define c_set_deadlock_grace(x) do {} while (0)
+
+#define c_explore(setup, routines, args, count) (0)
+#define c_block_footprint(x, y, z) do {} while(0)
+#define c_block_range(a, b, c, d) do {} while(0)
+#define c_set_parallel_jobs(x) do {} while(0)
+#define c_set_parallel_timeout(x) do {} while(0)
+#define c_run_parallel(test, arg, generator, state, results, capacity) (0)
+#define c_run_interleavings(test, arg, interleavings, count, results) (0)
+#define c_run_schedule(routines, args, count, interleaving) ((c_result_t) { 0 })
+#define c_ctx_run_schedule(c, routines, args, count, interleaving) ((c_result_t) { 0 })
+#define c_set_schedule_timeout(x) do {} while(0)
+#define c_ctx_set_schedule_timeout(c, x) do {} while(0)
+
+#define c_enable_stats(x) do {} while(0)
+#define c_block_stats(x, y) (0)
+#define c_event_stats(x, y) (0)
+#define c_print_stats() do {} while(0)
 
 #define c_output(x, ...) do {} while(0)
 #define c_out(x, ...) do {} while (0)
@@ -153,13 +476,17 @@ void c_output(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
 #define c_is_event_published(x) do {} while(0)
 
 #define c_set_blocks_interleaving(x) do {} while(0)
+#define c_set_blocks_interleaving_timeout(x, y) do {} while(0)
 #define c_begin_block(x) do {} while(0)
 #define c_end_block() do {} while(0)
 #define c_is_before_block(x) do {} while(0)
 #define c_is_during_block(x) do {} while(0)
 #define c_is_after_block(x) do {} while(0)
+#define c_begin_block_bool(x, y) (y)
+#define c_end_block_bool(x) (x)
 #define c_cond_block(COND, BLOCK) COND
 
+#define c_assert_failed(file, line, ...) do {} while(0)
 #define c_assert_true(x, y, ...) do {} while(0)
 #define c_assert_false(x, y, ...) do {} while(0)
 #define c_assert_before_event(EVENT, FMT, ...) do {} while (0)
@@ -170,8 +497,4 @@ void c_output(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
 
 #endif
 
-#ifdef __cplusplus
-}
-#endif
-
 #endif
@@ -0,0 +1,158 @@
+/*
+ * context.h - Independent testing contexts for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __CONTEXT_H
+#define __CONTEXT_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "events.h"
+#include "htable.h"
+#include "pool.h"
+#include "schedule.h"
+#include "threads.h"
+
+struct explorer;
+
+/**
+ * State of single test run by Coconut. Contexts share nothing but output,
+ * trace, statistics and declared footprints, so unrelated tests may run in
+ * different contexts at the same time. Every thread has its current context,
+ * used by functions not taking one explicitly; it is the default context
+ * (the one of c_init) unless the thread chose other one.
+ * threads_list - list of all registered threads - threads which used events or blocks
+ * threads_list_mutex - mutex for threads_list, taken only on threads registration and by watchdog
+ * runnable_threads - number of live registered threads not blocked on Coconut primitives, watchdog is notified when it drops to zero
+ * live_threads - number of registered threads which haven't exited yet
+ * threads_count - number of threads registered so far, used for numbering them
+ * exit_key - its destructor tracks exits of registered threads
+ * threads_arena - memory of threads_list entries, guarded by threads_list_mutex
+ * running - true if context is set up and running
+ * generation - unique among all contexts ever set up, invalidates cached handles
+ * allocated - true if context was allocated by c_ctx_init and is freed by c_ctx_free
+ * assertions_failed - number of failed assertions so far
+ * assertion_buffer - receives first failed assertion message, if set
+ * assertion_buffer_size - size of assertion_buffer
+ * assertion_captured - true if assertion_buffer got its message already
+ * watchdog_thread - thread detecting deadlocks
+ * watchdog_mutex - guards watchdog flags and cond
+ * watchdog_cond - signalled to wake watchdog up
+ * watchdog_notified - true if watchdog should check for deadlock immediately
+ * watchdog_rearmed - true if watchdog should recompute its wake up time
+ * watchdog_tick - period of watchdog's checks in nanoseconds
+ * deadlock_grace - time in milliseconds all threads have to stay blocked to be deadlocked
+ * epoch - epoch of events' gates, bumped to unpublish all of them
+ * events_list - list of all registered events
+ * events_list_mutex - serializes registration of new events only, lookups by id are lock-free
+ * events_table - event id -> event
+ * events_arena - memory of events and events_table, guarded by events_list_mutex
+ * current_schedule - currently used schedule, NULL if no interleaving was set
+ * blocks_mutex - serializes changes of current_schedule and forced finishing of blocks
+ * schedules_table - interleaving -> compiled schedule cache
+ * blocks_arena - memory of compiled schedules and their cache, guarded by blocks_mutex
+ * schedule_deadline - monotonic ns, 0 if current schedule has no timeout
+ * schedule_timeout - timeout of current schedule in ns, deadline is restarted from it on reset
+ * schedules_expired - number of schedules whose blocks got finished by their timeout
+ * explored_arena - memory of schedule set by set_explored_interleaving, reset when next one is set
+ * explored_epoch - epoch of last explored schedule, next one continues from it
+ * recording - true during recording pass of exploration
+ * recorded - explorer being filled by recording pass
+ * pool - threads running routines of c_run_schedule and c_explore
+ */
+typedef struct c_context
+{
+	thread_t threads_list;
+	pthread_mutex_t threads_list_mutex;
+	unsigned long runnable_threads __attribute__ ((aligned (CACHE_LINE_SIZE))); // written by every blocking thread
+	unsigned long live_threads;
+	unsigned int threads_count;
+	pthread_key_t exit_key;
+	arena_t threads_arena;
+
+	bool running __attribute__ ((aligned (CACHE_LINE_SIZE)));
+	unsigned long generation;
+	bool allocated;
+	unsigned long assertions_failed;
+	char *assertion_buffer;
+	size_t assertion_buffer_size;
+	bool assertion_captured;
+
+	pthread_t watchdog_thread;
+	pthread_mutex_t watchdog_mutex;
+	pthread_cond_t watchdog_cond;
+	bool watchdog_notified;
+	bool watchdog_rearmed;
+	unsigned long long watchdog_tick;
+	unsigned int deadlock_grace;
+
+	unsigned int epoch;
+	event_t events_list;
+	pthread_mutex_t events_list_mutex;
+	htable_t events_table;
+	arena_t events_arena;
+
+	schedule_t *current_schedule;
+	pthread_mutex_t blocks_mutex;
+	htable_t schedules_table;
+	arena_t blocks_arena;
+	unsigned long long schedule_deadline;
+	unsigned long long schedule_timeout;
+	unsigned long schedules_expired;
+	arena_t explored_arena;
+	unsigned int explored_epoch;
+
+	bool recording;
+	struct explorer *recorded;
+
+	pool_t pool;
+} context_t;
+
+/**
+ * Context of threads which didn't choose other one, set up by c_init.
+ */
+extern context_t default_context;
+
+/**
+ * Returns current context of calling thread.
+ */
+context_t *current_context();
+
+/**
+ * Client function setting up new context and returning it, NULL if it
+ * couldn't be allocated. Context isn't running if Coconut is disabled, but
+ * still has to be freed.
+ */
+context_t *c_ctx_init();
+
+/**
+ * Client function tearing context down, frees it if it was set up by
+ * c_ctx_init.
+ */
+void c_ctx_free(context_t *context);
+
+/**
+ * Client function bringing context back to state right after it was set up
+ * with its current interleaving set: all events become unpublished and all
+ * blocks not begun, in constant time. Registered events, compiled schedules,
+ * threads and watchdog are reused. Nobody may wait for events or be inside
+ * blocks meanwhile.
+ */
+void c_ctx_reset(context_t *context);
+
+/**
+ * Client function making context current for calling thread, NULL means
+ * default context.
+ */
+void c_set_context(context_t *context);
+
+/**
+ * Client function returning current context of calling thread.
+ */
+context_t *c_get_context();
+
+#endif
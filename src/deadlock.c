@@ -0,0 +1,314 @@
+/*
+ * deadlock.c - Deadlock analysis for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "blocks.h"
+#include "coconut.h"
+#include "context.h"
+#include "deadlock.h"
+#include "events.h"
+#include "output.h"
+#include "threads.h"
+#include "trace.h"
+
+enum
+{
+	WHITE,
+	GREY,
+	BLACK,
+};
+
+/**
+ * Blocked thread in wait-for graph. What it waits for is copied when graph
+ * is built, thread clears its own fields without any lock once it wakes up.
+ * thread - blocked thread
+ * waits_block - block it waits to start, NULL if it waits for event
+ * waits_event - event it waits for, NULL if it waits for block
+ */
+typedef struct
+{
+	thread_t *thread;
+	block_t *waits_block;
+	event_t *waits_event;
+} node_t;
+
+/**
+ * Wait-for graph snapshot. Nodes are blocked threads, thread waiting for
+ * preds of its block has an edge to every blocked thread owning unfinished
+ * pred.
+ * nodes - blocked threads
+ * count - number of nodes
+ * color - DFS color of each node
+ * path - current DFS path
+ * path_via - pred block leading from path[i] to path[i + 1]
+ * depth - length of current DFS path
+ */
+typedef struct
+{
+	node_t *nodes;
+	int count;
+	int *color;
+	int *path;
+	block_t **path_via;
+	int depth;
+} graph_t;
+
+static int node_of(const graph_t *graph, const thread_t *thread)
+{
+	int i;
+
+	for (i = 0; i < graph->count; ++i)
+		if (graph->nodes[i].thread == thread)
+			return i;
+
+	return -1;
+}
+
+/* returns pred of block with given ordinal among unfinished preds, NULL if none */
+static block_t *unfinished_pred(const block_t *block, unsigned int nth)
+{
+	const schedule_t *schedule = block->schedule;
+	unsigned int i = block - schedule->blocks;
+	unsigned int j;
+	block_t *pred;
+
+	for (j = schedule->preds_offsets[i]; j < schedule->preds_offsets[i + 1]; ++j)
+	{
+		pred = &schedule->blocks[schedule->preds[j]];
+		if (block_state(pred) != FINISHED && nth-- == 0)
+			return pred;
+	}
+
+	return NULL;
+}
+
+/* returns owner of begun pred, NULL if it isn't begun */
+static thread_t *pred_owner(const block_t *pred)
+{
+	if (block_state(pred) == CREATED) // acquires owner stored together with state
+		return NULL;
+
+	return __atomic_load_n(&pred->owner_thread, __ATOMIC_RELAXED);
+}
+
+/* returns node owning pred, -1 if pred isn't owned by blocked thread */
+static int owner_node(const graph_t *graph, const block_t *pred)
+{
+	thread_t *owner = pred_owner(pred);
+
+	return owner ? node_of(graph, owner) : -1;
+}
+
+/* DFS from node u, returns position in path where found cycle starts, -1 if none */
+static int find_cycle(graph_t *graph, int u)
+{
+	const node_t *node = &graph->nodes[u];
+	block_t *pred;
+	unsigned int nth;
+	int start;
+	int v;
+	int i;
+
+	graph->color[u] = GREY;
+	graph->path[graph->depth++] = u;
+
+	for (nth = 0; node->waits_block && (pred = unfinished_pred(node->waits_block, nth)); ++nth)
+	{
+		v = owner_node(graph, pred);
+		if (v < 0 || graph->color[v] == BLACK)
+			continue;
+
+		graph->path_via[graph->depth - 1] = pred;
+
+		if (graph->color[v] == GREY) // back edge closes cycle
+		{
+			for (i = 0; graph->path[i] != v; ++i)
+				;
+			return i;
+		}
+
+		if ((start = find_cycle(graph, v)) >= 0)
+			return start;
+	}
+
+	graph->color[u] = BLACK;
+	--graph->depth;
+
+	return -1;
+}
+
+/* returns true if node has edge to another blocked thread */
+static bool has_edges(const graph_t *graph, int u)
+{
+	const node_t *node = &graph->nodes[u];
+	block_t *pred;
+	unsigned int nth;
+
+	for (nth = 0; node->waits_block && (pred = unfinished_pred(node->waits_block, nth)); ++nth)
+		if (owner_node(graph, pred) >= 0)
+			return true;
+
+	return false;
+}
+
+/* lets thread blocked on block or event go */
+static void release(const node_t *node)
+{
+	if (node->waits_event)
+	{
+		trace_op(TRACE_DEADLOCK, &node->waits_event->trace_id, node->waits_event->id);
+		c_ctx_publish_event(node->thread->context, node->waits_event->id);
+	}
+	else
+	{
+		trace_op(TRACE_DEADLOCK, &node->waits_block->trace_id, node->waits_block->id);
+		gate_open(&node->waits_block->ready, schedule_epoch(node->waits_block->schedule)); // start block despite unfinished preds
+	}
+}
+
+/* whole report goes out in one c_output call, so other output can't split it */
+static void report_cycle(const graph_t *graph, int start)
+{
+	const node_t *node;
+	const node_t *owner;
+	block_t *via;
+	char *text = NULL;
+	size_t size = 0;
+	FILE *stream = open_memstream(&text, &size);
+	int i;
+
+	if (!stream)
+		return;
+
+	fprintf(stream, "Deadlock detected, wait-for cycle:\n");
+	for (i = start; i < graph->depth; ++i)
+	{
+		node = &graph->nodes[graph->path[i]];
+		owner = &graph->nodes[graph->path[i + 1 < graph->depth ? i + 1 : start]]; // next on cycle owns block waited for
+		via = graph->path_via[i];
+		fprintf(stream, "  thread #%u in block %s waits for block %s of thread #%u\n", node->thread->index, node->waits_block->id, via->id, owner->thread->index);
+	}
+
+	node = &graph->nodes[graph->path[start]];
+	fprintf(stream, "Fixed interleaving is probably impossible. Starting block %s out of order...\n", node->waits_block->id);
+	fclose(stream);
+
+	c_output("%s", text);
+	free(text);
+}
+
+static void report_starving(const node_t *node)
+{
+	block_t *pred;
+	thread_t *owner;
+
+	if (node->waits_event)
+	{
+		c_output("Deadlock detected, thread #%u waits for event %s which nobody publishes. Publishing it...\n", node->thread->index, node->waits_event->id);
+		return;
+	}
+
+	pred = unfinished_pred(node->waits_block, 0);
+	owner = pred ? pred_owner(pred) : NULL;
+	if (!pred) // preds finished after snapshot, yet the gate stayed closed
+		c_output("Deadlock detected, thread #%u in block %s waits although all preceding blocks are finished, the wait can't be explained. Starting block %s...\n", node->thread->index, node->waits_block->id, node->waits_block->id);
+	else if (block_state(pred) == CREATED)
+		c_output("Deadlock detected, thread #%u in block %s waits for block %s which nobody began. Fixed interleaving is probably impossible. Starting block %s out of order...\n", node->thread->index, node->waits_block->id, pred->id, node->waits_block->id);
+	else if (!owner)
+		c_output("Deadlock detected, thread #%u in block %s waits for block %s which doesn't end. Fixed interleaving is probably impossible. Starting block %s out of order...\n", node->thread->index, node->waits_block->id, pred->id, node->waits_block->id);
+	else
+		c_output("Deadlock detected, thread #%u in block %s waits for block %s of thread #%u which doesn't end it. Fixed interleaving is probably impossible. Starting block %s out of order...\n", node->thread->index, node->waits_block->id, pred->id, owner->index, node->waits_block->id);
+}
+
+static void resolve_all(context_t *context)
+{
+	c_output("Deadlock detected, fixed interleaving is probably impossible. Perhaps synchronization is correct or you should adjust watchdog tick with $C_WATCHDOG_TICK or deadlock grace period with $C_DEADLOCK_GRACE. Publishing all events, finishing all blocks...\n");
+	trace_record(TRACE_DEADLOCK, 0);
+
+	pthread_mutex_lock(&context->events_list_mutex);
+	publish_all_events(context);
+	pthread_mutex_unlock(&context->events_list_mutex);
+
+	pthread_mutex_lock(&context->blocks_mutex);
+	finish_all_blocks(context);
+	pthread_mutex_unlock(&context->blocks_mutex);
+
+	flush_output(); // report shouldn't wait for flusher, program may die meanwhile
+}
+
+void resolve_deadlock(context_t *context)
+{
+	graph_t graph;
+	thread_t *thread;
+	node_t *node;
+	const node_t *victim = NULL;
+	list_t *it;
+	int start = -1;
+	int i;
+
+	pthread_mutex_lock(&context->threads_list_mutex);
+
+	// snapshot blocked threads as graph nodes
+	graph.count = 0;
+	list_for_each(it, &context->threads_list.head)
+		++graph.count;
+	graph.nodes = malloc(sizeof(node_t) * (graph.count + 1));
+	graph.count = 0;
+	list_for_each(it, &context->threads_list.head)
+	{
+		thread = list_entry(it, thread_t, head);
+		if (__atomic_load_n(&thread->state, __ATOMIC_ACQUIRE) != THREAD_BLOCKED)
+			continue;
+
+		node = &graph.nodes[graph.count];
+		node->thread = thread;
+		node->waits_block = __atomic_load_n(&thread->waits_block, __ATOMIC_ACQUIRE);
+		node->waits_event = __atomic_load_n(&thread->waits_event, __ATOMIC_ACQUIRE);
+		if (node->waits_block || node->waits_event)
+			++graph.count;
+	}
+	graph.color = calloc(graph.count + 1, sizeof(int));
+	graph.path = malloc(sizeof(int) * (graph.count + 1));
+	graph.path_via = malloc(sizeof(block_t *) * (graph.count + 1));
+	graph.depth = 0;
+
+	// cycle is preferred, otherwise thread whose waiting doesn't depend on other blocked threads
+	for (i = 0; i < graph.count && start < 0; ++i)
+		if (graph.color[i] == WHITE)
+			start = find_cycle(&graph, i);
+
+	if (start >= 0)
+	{
+		victim = &graph.nodes[graph.path[start]];
+		report_cycle(&graph, start);
+	}
+	else
+	{
+		for (i = 0; i < graph.count && !victim; ++i)
+			if (!has_edges(&graph, i))
+				victim = &graph.nodes[i];
+		if (victim)
+			report_starving(victim);
+	}
+
+	if (victim)
+		release(victim);
+
+	pthread_mutex_unlock(&context->threads_list_mutex);
+
+	free(graph.path_via);
+	free(graph.path);
+	free(graph.color);
+	free(graph.nodes);
+
+	if (victim)
+		flush_output(); // report shouldn't wait for flusher, program may die meanwhile
+	else
+		resolve_all(context);
+}
@@ -0,0 +1,18 @@
+/*
+ * deadlock.h - Deadlock analysis for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __DEADLOCK_H
+#define __DEADLOCK_H
+
+struct c_context;
+
+/**
+ * Analyzes wait-for graph of threads blocked in context, reports cycle or
+ * starving thread and releases just one thread to make progress. Falls back
+ * to publishing all events and finishing all blocks if graph gives no clue.
+ */
+void resolve_deadlock(struct c_context *context);
+
+#endif
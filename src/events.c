@@ -3,147 +3,172 @@
  * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
  */
 
-#include <stdlib.h>
-#include <string.h>
-
 #include "coconut.h"
+#include "context.h"
 #include "events.h"
+#include "htable.h"
+#include "stats.h"
 #include "threads.h"
-
-event_t events_list;
-pthread_mutex_t events_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+#include "trace.h"
+#include "utils.h"
 
 /* should be called with events_list_mutex taken */
-static event_t *create_add_event(const char *id)
+static event_t *create_add_event(context_t *context, const char *id)
 {
-	event_t *event = malloc(sizeof(event_t));
-	event->id = id;
-	event->published = false;
-	pthread_cond_init(&event->cond, NULL);
-	pthread_mutex_init(&event->cond_mutex, NULL);
-	list_add_tail(&event->head, &events_list.head);
+	event_t *event = arena_alloc(&context->events_arena, sizeof(event_t));
+	gate_init(&event->gate);
+	list_add_tail(&event->head, &context->events_list.head);
+	event->trace_id = 0;
+	event->stats = NULL;
+	event->id = htable_insert(&context->events_table, id, event); // makes event visible to lock-free lookups
 
 	return event;
 }
 
-static void free_event(event_t *event)
+void init_events_list(context_t *context)
 {
-	pthread_mutex_destroy(&event->cond_mutex);
-	pthread_cond_destroy(&event->cond);
-	free(event);
+	context->epoch = 0;
+	INIT_LIST_HEAD(&context->events_list.head);
+	pthread_mutex_init(&context->events_list_mutex, NULL);
+	arena_init(&context->events_arena);
+	htable_init(&context->events_table, &context->events_arena);
 }
 
-void free_events_list()
+void free_events_list(context_t *context)
 {
-	list_t *it, *tmp_it;
-	event_t *event;
+	// events and their table go away at once
+	INIT_LIST_HEAD(&context->events_list.head);
+	arena_free(&context->events_arena);
+	pthread_mutex_destroy(&context->events_list_mutex);
+}
 
-	list_for_each_safe(it, tmp_it, &events_list.head)
-	{
-		event = list_entry(it, event_t, head);
-		list_del(it);
-		free_event(event);
-	}
+/* lock-free, may be called without events_list_mutex */
+static event_t *find_event(context_t *context, const char *id)
+{
+	return htable_find(&context->events_table, id);
 }
 
-/* should be called with events_list_mutex taken */
-static event_t *find_event(const char *id)
+/* returns existing event or registers new one */
+static event_t *find_create_event(context_t *context, const char *id)
 {
-	event_t *event;
-	list_t *it;
+	event_t *event = find_event(context, id);
 
-	list_for_each(it, &events_list.head)
-	{
-		event = list_entry(it, event_t, head);
-		if (strcmp(event->id, id) == 0)
-			return event;
-	}
+	if (event) // fast path, no locking
+		return event;
+
+	pthread_mutex_lock(&context->events_list_mutex);
+
+	event = find_event(context, id); // recheck, someone could register it meanwhile
+	if (!event)
+		event = create_add_event(context, id);
+
+	pthread_mutex_unlock(&context->events_list_mutex);
+
+	return event;
+}
+
+static unsigned int events_epoch(context_t *context)
+{
+	return __atomic_load_n(&context->epoch, __ATOMIC_ACQUIRE);
+}
 
-	return NULL;
+static bool is_published(context_t *context, event_t *event)
+{
+	return gate_is_open(&event->gate, events_epoch(context));
 }
 
-static void publish_event(event_t *event)
+static void publish_event(context_t *context, event_t *event)
 {
-	pthread_mutex_lock(&event->cond_mutex);
-	event->published = true;
-	pthread_cond_broadcast(&event->cond);
-	pthread_mutex_unlock(&event->cond_mutex);
+	gate_open(&event->gate, events_epoch(context));
 }
 
 /* should be called with events_list_mutex taken */
-void publish_all_events()
+void publish_all_events(context_t *context)
 {
 	event_t *event;
 	list_t *it;
 
-	list_for_each(it, &events_list.head)
+	list_for_each(it, &context->events_list.head)
 	{
 		event = list_entry(it, event_t, head);
-		publish_event(event);
+		publish_event(context, event);
 	}
 
 }
 
-bool c_is_event_published(const char *id)
+void reset_all_events(context_t *context)
+{
+	// gates published in previous epoch count as closed, registry stays as is
+	__atomic_store_n(&context->epoch, next_epoch(context->epoch), __ATOMIC_RELEASE);
+}
+
+bool c_ctx_is_event_published(context_t *context, const char *id)
 {
 	event_t *event;
 
-	if (!running)
+	if (!context->running)
 		return false;
 
-	pthread_mutex_lock(&events_list_mutex);
+	event = find_event(context, id);
 
-	event = find_event(id);
-
-	pthread_mutex_unlock(&events_list_mutex);
-
-	if (!event)
-		return false;
-
-	return event->published == true;
+	return event && is_published(context, event);
 }
 
-void c_wait_event(const char *id)
+void c_ctx_wait_event(context_t *context, const char *id)
 {
 	event_t *event;
+	uint64_t start = 0;
+	bool recorded;
 
-	if (!running)
+	if (!context->running)
 		return;
 
-	pthread_mutex_lock(&events_list_mutex);
+	event = find_create_event(context, id); // not found -> create new and block after
 
-	event = find_event(id);
-	if (!event) // not found -> create new and block after
-		event = create_add_event(id);
-
-	pthread_mutex_unlock(&events_list_mutex);
+	if (is_published(context, event)) // already published, no need to block
+		return;
 
-	mark_self_blocked();
+	trace_op(TRACE_EVENT_WAIT, &event->trace_id, event->id);
+	mark_self_blocked(context, NULL, event);
 
-	pthread_mutex_lock(&event->cond_mutex);
-	while (!event->published) // wait on conditional
-		pthread_cond_wait(&event->cond, &event->cond_mutex);
-	pthread_mutex_unlock(&event->cond_mutex);
+	recorded = stats_enabled;
+	if (recorded)
+		start = monotonic_ns();
+	gate_wait(&event->gate, events_epoch(context));
+	if (recorded)
+		stats_record(stats_histogram(STATS_EVENT, &event->stats, event->id), monotonic_ns() - start);
 
-	mark_self_unblocked();
+	mark_self_unblocked(context);
+	trace_op(TRACE_EVENT_WAKE, &event->trace_id, event->id);
 }
 
-void c_publish_event(const char *id)
+void c_ctx_publish_event(context_t *context, const char *id)
 {
 	event_t *event;
 
-	if (!running)
+	if (!context->running)
 		return;
 
-	pthread_mutex_lock(&events_list_mutex);
+	event = find_create_event(context, id);
 
-	event = find_event(id);
-	if (!event)
-		event = create_add_event(id);
+	if (!is_published(context, event))
+	{
+		trace_op(TRACE_EVENT_PUBLISH, &event->trace_id, event->id); // recorded before any wake it causes
+		publish_event(context, event);
+	}
+}
 
-	if (!event->published)
-		publish_event(event);
+bool c_is_event_published(const char *id)
+{
+	return c_ctx_is_event_published(current_context(), id);
+}
 
-	pthread_mutex_unlock(&events_list_mutex);
+void c_wait_event(const char *id)
+{
+	c_ctx_wait_event(current_context(), id);
 }
 
+void c_publish_event(const char *id)
+{
+	c_ctx_publish_event(current_context(), id);
+}
@@ -8,46 +8,51 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 
+#include "gate.h"
 #include "list.h"
 
+struct c_context;
+
 /**
  * Event representation in Coconut.
  * head - list head
- * cond_mutex - mutex for cond conditional variable
- * cond - conditional variable for signalling that event was published
- * id - id string
- * published - true if event was published, false otherwise
+ * gate - gate opened when event is published
+ * id - id string, interned in events hash table
+ * trace_id - id interned by trace recorder, 0 until first traced
+ * stats - blocked time histogram of id, NULL until first waited for
  */
-typedef struct
+typedef struct event
 {
 	list_t head;
-	pthread_mutex_t cond_mutex;
-	pthread_cond_t cond;
+	gate_t gate;
 	const char *id;
-	bool published;
+	uint32_t trace_id;
+	struct histogram *stats;
 } event_t;
 
 /**
- * List of all registered events.
+ * Initializes context's events_list and its lookup table.
  */
-extern event_t events_list;
+void init_events_list(struct c_context *context);
 
 /**
- * Mutex for events_list.
+ * Memory freeing function for events in context's events_list.
  */
-extern pthread_mutex_t events_list_mutex;
+void free_events_list(struct c_context *context);
 
 /**
- * Memory freeing function for events in events_list.
+ * Publishes all events registered in context.
+ * Should be called with events_list_mutex taken.
  */
-void free_events_list();
+void publish_all_events(struct c_context *context);
 
 /**
- * Publishes all registered events.
- * Should be called with events_list_mutex taken.
+ * Makes all events registered in context unpublished again by bumping its
+ * epoch, in constant time. Nobody may be waiting for them meanwhile.
  */
-void publish_all_events();
+void reset_all_events(struct c_context *context);
 
 /**
  * Client function to check if event was already published.
@@ -64,4 +69,11 @@ void c_wait_event(const char *event);
  */
 void c_publish_event(const char *event);
 
+/**
+ * Client functions as above, working in given context.
+ */
+bool c_ctx_is_event_published(struct c_context *context, const char *event);
+void c_ctx_wait_event(struct c_context *context, const char *event);
+void c_ctx_publish_event(struct c_context *context, const char *event);
+
 #endif
@@ -0,0 +1,484 @@
+/*
+ * explore.c - Exploration of block interleavings for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blocks.h"
+#include "coconut.h"
+#include "context.h"
+#include "events.h"
+#include "explore.h"
+#include "pool.h"
+
+/**
+ * Arguments of explored thread trampoline.
+ * routine - tested routine
+ * arg - its argument
+ * slot - index of thread within explored ones
+ */
+typedef struct trampoline
+{
+	c_thread_routine_t routine;
+	void *arg;
+	unsigned int slot;
+} trampoline_t;
+
+static pthread_mutex_t explore_mutex = PTHREAD_MUTEX_INITIALIZER; // serializes recording and declaring footprints
+static footprint_t footprints_list;
+static htable_t footprints_table; // block id -> footprint
+static arena_t explore_arena; // footprints, their table and resource names, guarded by explore_mutex
+static __thread int explore_slot = -1; // index of explored thread, -1 for others
+
+void init_explore()
+{
+	INIT_LIST_HEAD(&footprints_list.head);
+	arena_init(&explore_arena);
+	htable_init(&footprints_table, &explore_arena);
+}
+
+void free_explore()
+{
+	list_t *it, *tmp_it;
+	footprint_t *footprint;
+
+	list_for_each_safe(it, tmp_it, &footprints_list.head)
+	{
+		footprint = list_entry(it, footprint_t, head);
+		list_del(it);
+		free(footprint->reads);
+		free(footprint->writes);
+		free(footprint->ranges);
+	}
+	arena_free(&explore_arena);
+}
+
+/* should be called with explore_mutex taken */
+static footprint_t *find_create_footprint(const char *block)
+{
+	footprint_t *footprint = htable_find(&footprints_table, block);
+
+	if (!footprint)
+	{
+		footprint = arena_alloc(&explore_arena, sizeof(footprint_t));
+		list_add_tail(&footprint->head, &footprints_list.head);
+		htable_insert(&footprints_table, block, footprint);
+	}
+
+	return footprint;
+}
+
+/* should be called with explore_mutex taken, appends copies of comma-separated names */
+static void add_resources(char ***resources, size_t *count, const char *names)
+{
+	size_t length;
+
+	for (; names && *names; names += length + (names[length] == ','))
+	{
+		length = strcspn(names, ",");
+		if (length == 0)
+			continue;
+
+		*resources = realloc(*resources, sizeof(char *) * (*count + 1));
+		(*resources)[(*count)++] = arena_strndup(&explore_arena, names, length);
+	}
+}
+
+void c_block_footprint(const char *block, const char *reads, const char *writes)
+{
+	footprint_t *footprint;
+
+	if (!running)
+		return;
+
+	pthread_mutex_lock(&explore_mutex);
+	footprint = find_create_footprint(block);
+	add_resources(&footprint->reads, &footprint->reads_count, reads);
+	add_resources(&footprint->writes, &footprint->writes_count, writes);
+	pthread_mutex_unlock(&explore_mutex);
+}
+
+void c_block_range(const char *block, const void *address, size_t size, bool write)
+{
+	footprint_t *footprint;
+
+	if (!running)
+		return;
+
+	pthread_mutex_lock(&explore_mutex);
+	footprint = find_create_footprint(block);
+	footprint->ranges = realloc(footprint->ranges, sizeof(range_t) * (footprint->ranges_count + 1));
+	footprint->ranges[footprint->ranges_count++] = (range_t) { (uintptr_t) address, (uintptr_t) address + size, write };
+	pthread_mutex_unlock(&explore_mutex);
+}
+
+static bool shares_resource(char **a, size_t a_count, char **b, size_t b_count)
+{
+	size_t i, j;
+
+	for (i = 0; i < a_count; ++i)
+		for (j = 0; j < b_count; ++j)
+			if (strcmp(a[i], b[j]) == 0)
+				return true;
+
+	return false;
+}
+
+/* blocks without declared footprint are dependent on everything */
+static bool independent(const footprint_t *a, const footprint_t *b)
+{
+	size_t i, j;
+
+	if (!a || !b)
+		return false;
+
+	if (shares_resource(a->writes, a->writes_count, b->writes, b->writes_count) ||
+		shares_resource(a->writes, a->writes_count, b->reads, b->reads_count) ||
+		shares_resource(a->reads, a->reads_count, b->writes, b->writes_count))
+		return false;
+
+	for (i = 0; i < a->ranges_count; ++i)
+		for (j = 0; j < b->ranges_count; ++j)
+			if ((a->ranges[i].write || b->ranges[j].write) && a->ranges[i].start < b->ranges[j].end && b->ranges[j].start < a->ranges[i].end)
+				return false;
+
+	return true;
+}
+
+static void *trampoline(void *arg)
+{
+	trampoline_t *trampoline = arg;
+
+	void *result;
+
+	explore_slot = trampoline->slot;
+	result = trampoline->routine(trampoline->arg);
+	explore_slot = -1; // pooled thread may run other routines later
+
+	return result;
+}
+
+void run_routines(context_t *context, explorer_t *explorer, void (*setup)(), c_thread_routine_t *routines, void **args, unsigned int count)
+{
+	unsigned int i;
+
+	reset_all_events(context);
+	if (setup)
+		setup();
+
+	for (i = 0; i < count; ++i)
+		explorer->trampolines[i] = (trampoline_t) { routines[i], args ? args[i] : NULL, i };
+	pool_run(context, explorer->trampoline_routines, explorer->trampoline_args, count); // pooled threads are bound to context already
+}
+
+void record_block(context_t *context, const char *id)
+{
+	explorer_t *recorded;
+	sequence_t *sequence;
+
+	pthread_mutex_lock(&explore_mutex);
+
+	recorded = context->recorded;
+	if (explore_slot < 0 || !recorded)
+	{
+		c_output("Block %s begun outside of explored threads. Skipping...\n", id);
+	}
+	else if (htable_find(&recorded->ids, id))
+	{
+		if (!recorded->error)
+			recorded->error = arena_strndup(&recorded->arena, id, strlen(id));
+	}
+	else
+	{
+		sequence = &recorded->sequences[explore_slot];
+		if (sequence->count == sequence->capacity)
+		{
+			sequence->capacity = sequence->capacity ? 2 * sequence->capacity : 8;
+			sequence->ids = realloc(sequence->ids, sizeof(const char *) * sequence->capacity);
+		}
+		sequence->ids[sequence->count++] = htable_insert(&recorded->ids, id, sequence);
+	}
+
+	pthread_mutex_unlock(&explore_mutex);
+}
+
+static footprint_t *next_footprint(const explorer_t *explorer, unsigned int thread)
+{
+	return explorer->sequences[thread].footprints[explorer->positions[thread]];
+}
+
+/* returns first thread which has blocks left and may be taken from frame, -1 if none */
+static int first_allowed(const explorer_t *explorer, const frame_t *frame)
+{
+	unsigned int t;
+
+	for (t = 0; t < explorer->threads_count; ++t)
+		if (explorer->positions[t] < explorer->sequences[t].count && !((frame->sleep | frame->done) >> t & 1))
+			return t;
+
+	return -1;
+}
+
+/* extends current path as far as possible, returns true if it got complete */
+static bool descend(explorer_t *explorer)
+{
+	frame_t *frame;
+	unsigned long long covered;
+	unsigned long long sleep;
+	unsigned int u;
+	int t;
+
+	while (explorer->depth < explorer->total)
+	{
+		frame = &explorer->frames[explorer->depth];
+		if ((t = first_allowed(explorer, frame)) < 0) // everything left sleeps, path is redundant
+			return false;
+
+		// threads covered here stay asleep below as long as their next block commutes with taken one
+		covered = frame->sleep | frame->done;
+		sleep = 0;
+		for (u = 0; u < explorer->threads_count; ++u)
+			if ((covered >> u & 1) && independent(next_footprint(explorer, t), next_footprint(explorer, u)))
+				sleep |= 1ULL << u;
+
+		frame->choice = t;
+		explorer->order[explorer->depth] = t;
+		++explorer->positions[t];
+		++explorer->depth;
+		explorer->frames[explorer->depth] = (frame_t) { sleep, 0, 0 };
+	}
+
+	return true;
+}
+
+/* undoes choices until some frame has another one allowed, returns false if search is over */
+static bool backtrack(explorer_t *explorer)
+{
+	frame_t *frame;
+
+	while (explorer->depth > 0)
+	{
+		frame = &explorer->frames[--explorer->depth];
+		--explorer->positions[frame->choice];
+		frame->done |= 1ULL << frame->choice;
+		if (first_allowed(explorer, frame) >= 0)
+			return true;
+	}
+
+	return false;
+}
+
+static bool next_reduced(explorer_t *explorer)
+{
+	do
+		if (!backtrack(explorer))
+			return false;
+	while (!descend(explorer));
+
+	return true;
+}
+
+bool init_explorer(context_t *context, explorer_t *explorer, void (*setup)(), c_thread_routine_t *routines, void **args, unsigned int count)
+{
+	size_t length = 0;
+	size_t i, j;
+	unsigned int t;
+
+	arena_init(&explorer->arena);
+	htable_init(&explorer->ids, &explorer->arena);
+	explorer->sequences = calloc(count ? count : 1, sizeof(sequence_t));
+	explorer->threads_count = count;
+	explorer->error = NULL;
+
+	// scratch reused by every run and interleaving, so exploring allocates nothing per run
+	explorer->next = arena_alloc(&explorer->arena, sizeof(size_t) * (count ? count : 1));
+	explorer->trampolines = arena_alloc(&explorer->arena, sizeof(trampoline_t) * (count ? count : 1));
+	explorer->trampoline_routines = arena_alloc(&explorer->arena, sizeof(c_thread_routine_t) * (count ? count : 1));
+	explorer->trampoline_args = arena_alloc(&explorer->arena, sizeof(void *) * (count ? count : 1));
+	for (t = 0; t < count; ++t)
+	{
+		explorer->trampoline_routines[t] = trampoline;
+		explorer->trampoline_args[t] = &explorer->trampolines[t];
+	}
+
+	// recording pass: blocks don't wait, they are just noted down
+	pthread_mutex_lock(&explore_mutex);
+	context->recorded = explorer;
+	__atomic_store_n(&context->recording, true, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&explore_mutex);
+
+	run_routines(context, explorer, setup, routines, args, count);
+
+	pthread_mutex_lock(&explore_mutex);
+	__atomic_store_n(&context->recording, false, __ATOMIC_RELEASE);
+	context->recorded = NULL;
+	pthread_mutex_unlock(&explore_mutex);
+
+	// first linearization is the lexicographically smallest one: all of thread 0, then thread 1...
+	explorer->total = 0;
+	for (t = 0; t < count; ++t)
+		explorer->total += explorer->sequences[t].count;
+	explorer->order = malloc(sizeof(unsigned int) * (explorer->total ? explorer->total : 1));
+	for (t = 0, i = 0; t < count; ++t)
+		for (j = 0; j < explorer->sequences[t].count; ++j)
+		{
+			explorer->order[i++] = t;
+			length += strlen(explorer->sequences[t].ids[j]) + 1;
+		}
+	explorer->interleaving = malloc(length + 1);
+
+	// any declared footprint turns reduction on
+	explorer->reduced = false;
+	pthread_mutex_lock(&explore_mutex);
+	for (t = 0; t < count; ++t)
+	{
+		explorer->sequences[t].footprints = malloc(sizeof(footprint_t *) * (explorer->sequences[t].count ? explorer->sequences[t].count : 1));
+		for (j = 0; j < explorer->sequences[t].count; ++j)
+			if ((explorer->sequences[t].footprints[j] = htable_find(&footprints_table, explorer->sequences[t].ids[j])))
+				explorer->reduced = true;
+	}
+	pthread_mutex_unlock(&explore_mutex);
+	if (count > MAX_REDUCED_THREADS)
+		explorer->reduced = false;
+
+	explorer->frames = NULL;
+	explorer->positions = NULL;
+	if (explorer->reduced)
+	{
+		explorer->frames = malloc(sizeof(frame_t) * (explorer->total + 1));
+		explorer->positions = calloc(count ? count : 1, sizeof(size_t));
+		explorer->frames[0] = (frame_t) { 0, 0, 0 };
+		explorer->depth = 0;
+		descend(explorer); // nothing sleeps on first path, so it always completes
+	}
+
+	return explorer->error == NULL;
+}
+
+const char *explorer_interleaving(explorer_t *explorer)
+{
+	size_t *next = explorer->next;
+	size_t length = 0;
+	const char *id;
+	size_t i;
+
+	memset(next, 0, sizeof(size_t) * explorer->threads_count);
+
+	// every block gets own group, so linearization is enforced as a whole
+	explorer->interleaving[0] = '\0';
+	for (i = 0; i < explorer->total; ++i)
+	{
+		id = explorer->sequences[explorer->order[i]].ids[next[explorer->order[i]]++];
+		if (i)
+			explorer->interleaving[length++] = ';';
+		strcpy(explorer->interleaving + length, id);
+		length += strlen(id);
+	}
+
+	return explorer->interleaving;
+}
+
+static bool next_permutation(explorer_t *explorer)
+{
+	unsigned int *order = explorer->order;
+	unsigned int tmp;
+	size_t i, j;
+
+	if (explorer->total < 2)
+		return false;
+
+	// next permutation of multiset: find rightmost ascent, swap with rightmost greater, reverse tail
+	for (i = explorer->total - 1; i > 0 && order[i - 1] >= order[i]; --i)
+		;
+	if (i == 0)
+		return false;
+
+	for (j = explorer->total - 1; order[j] <= order[i - 1]; --j)
+		;
+	tmp = order[i - 1];
+	order[i - 1] = order[j];
+	order[j] = tmp;
+
+	for (j = explorer->total - 1; i < j; ++i, --j)
+	{
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	return true;
+}
+
+bool explorer_next(explorer_t *explorer)
+{
+	return explorer->reduced ? next_reduced(explorer) : next_permutation(explorer);
+}
+
+void free_explorer(explorer_t *explorer)
+{
+	unsigned int t;
+
+	for (t = 0; t < explorer->threads_count; ++t)
+	{
+		free(explorer->sequences[t].ids);
+		free(explorer->sequences[t].footprints);
+	}
+	free(explorer->frames);
+	free(explorer->positions);
+	free(explorer->sequences);
+	free(explorer->order);
+	free(explorer->interleaving);
+	arena_free(&explorer->arena);
+}
+
+unsigned long c_ctx_explore(context_t *context, void (*setup)(), c_thread_routine_t *routines, void **args, unsigned int count)
+{
+	explorer_t explorer;
+	unsigned long runs = 0;
+	unsigned long failed = 0;
+	unsigned long assertions;
+	const char *interleaving;
+
+	if (!context->running)
+		return 0;
+
+	if (!init_explorer(context, &explorer, setup, routines, args, count))
+	{
+		c_output("Block %s begun more than once during recording, exploring needs unique block ids. Skipping...\n", explorer.error);
+		free_explorer(&explorer);
+		return 0;
+	}
+
+	do
+	{
+		interleaving = explorer_interleaving(&explorer);
+		assertions = __atomic_load_n(&context->assertions_failed, __ATOMIC_ACQUIRE);
+
+		set_explored_interleaving(context, interleaving);
+		run_routines(context, &explorer, setup, routines, args, count);
+
+		++runs;
+		if (__atomic_load_n(&context->assertions_failed, __ATOMIC_ACQUIRE) != assertions)
+		{
+			++failed;
+			c_output("Interleaving %s failed.\n", interleaving);
+		}
+	}
+	while (explorer_next(&explorer));
+
+	set_explored_interleaving(context, NULL);
+	c_output("Explored %lu interleavings, %lu failed.\n", runs, failed);
+	free_explorer(&explorer);
+
+	return failed;
+}
+
+unsigned long c_explore(void (*setup)(), c_thread_routine_t *routines, void **args, unsigned int count)
+{
+	return c_ctx_explore(current_context(), setup, routines, args, count);
+}
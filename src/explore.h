@@ -0,0 +1,202 @@
+/*
+ * explore.h - Exploration of block interleavings for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __EXPLORE_H
+#define __EXPLORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "coconut_pub.h"
+#include "htable.h"
+#include "list.h"
+
+struct c_context;
+
+/**
+ * Maximum number of threads explored with partial-order reduction, more
+ * threads are explored exhaustively.
+ */
+#define MAX_REDUCED_THREADS 64
+
+/**
+ * Address range touched by block.
+ * start - first address
+ * end - address just past range
+ * write - true if range is written, false if only read
+ */
+typedef struct
+{
+	uintptr_t start;
+	uintptr_t end;
+	bool write;
+} range_t;
+
+/**
+ * Declared footprint of block. Two blocks are independent if neither of
+ * them writes resource or range the other one reads or writes.
+ * head - list head
+ * reads - names of read resources
+ * reads_count - number of read resources
+ * writes - names of written resources
+ * writes_count - number of written resources
+ * ranges - touched address ranges
+ * ranges_count - number of ranges
+ */
+typedef struct footprint
+{
+	list_t head;
+	char **reads;
+	size_t reads_count;
+	char **writes;
+	size_t writes_count;
+	range_t *ranges;
+	size_t ranges_count;
+} footprint_t;
+
+/**
+ * Frame of depth-first search over linearizations with sleep sets. Masks
+ * are indexed by thread.
+ * sleep - threads whose next block needn't be taken here, as taking it was
+ *         already covered by an equivalent linearization
+ * done - threads already taken from here
+ * choice - thread taken from here on current path
+ */
+typedef struct
+{
+	unsigned long long sleep;
+	unsigned long long done;
+	unsigned int choice;
+} frame_t;
+
+/**
+ * Block sequence of single explored thread, in program order.
+ * ids - block ids, interned in explorer's table
+ * footprints - declared footprints of blocks, NULL if undeclared
+ * count - number of blocks
+ * capacity - capacity of ids
+ */
+typedef struct
+{
+	const char **ids;
+	footprint_t **footprints;
+	size_t count;
+	size_t capacity;
+} sequence_t;
+
+/**
+ * Iterator over all linearizations of sequences consistent with program
+ * order of every thread. Linearization is kept as a word over thread
+ * indices (thread i appears sequences[i].count times), successive ones are
+ * generated in lexicographic order, so nothing but current one is stored.
+ * If any footprint is declared, linearizations differing only in order of
+ * independent blocks are equivalent and just one of each class is
+ * generated, by depth-first search with sleep sets.
+ * arena - memory of ids table and error
+ * ids - table of all recorded block ids, detects duplicates
+ * sequences - recorded sequences, one per thread
+ * threads_count - number of threads
+ * order - current linearization as thread indices
+ * total - length of order, number of all blocks
+ * interleaving - current linearization as interleaving string
+ * error - copy of id begun more than once during recording, NULL if none
+ * reduced - true if partial-order reduction is used
+ * frames - search stack, total + 1 frames, used if reduced
+ * positions - number of blocks of every thread on current path, used if reduced
+ * depth - length of current path, used if reduced
+ * next - per-thread cursors used while building interleaving
+ * trampolines - arguments of trampolines of explored threads
+ * trampoline_routines - trampoline repeated for every explored thread
+ * trampoline_args - pointers to trampolines entries
+ */
+typedef struct explorer
+{
+	arena_t arena;
+	htable_t ids;
+	sequence_t *sequences;
+	unsigned int threads_count;
+	unsigned int *order;
+	size_t total;
+	char *interleaving;
+	const char *error;
+	bool reduced;
+	frame_t *frames;
+	size_t *positions;
+	size_t depth;
+	size_t *next;
+	struct trampoline *trampolines;
+	c_thread_routine_t *trampoline_routines;
+	void **trampoline_args;
+} explorer_t;
+
+/**
+ * Records block begun by calling thread. Should be called only while
+ * context is recording.
+ */
+void record_block(struct c_context *context, const char *id);
+
+/**
+ * Runs recording pass of routines in context and prepares explorer for
+ * iteration. Returns false if recording failed, see error.
+ */
+bool init_explorer(struct c_context *context, explorer_t *explorer, void (*setup)(), c_thread_routine_t *routines, void **args, unsigned int count);
+
+/**
+ * Builds interleaving string of current linearization into explorer's
+ * interleaving and returns it.
+ */
+const char *explorer_interleaving(explorer_t *explorer);
+
+/**
+ * Advances to next linearization. Returns false if there are no more.
+ */
+bool explorer_next(explorer_t *explorer);
+
+/**
+ * Frees explorer memory.
+ */
+void free_explorer(explorer_t *explorer);
+
+/**
+ * Runs routines on count pooled threads of context, each with its args
+ * entry (or NULL), after calling setup (if any), and waits for all of them.
+ * Trampolines of threads are taken from explorer.
+ */
+void run_routines(struct c_context *context, explorer_t *explorer, void (*setup)(), c_thread_routine_t *routines, void **args, unsigned int count);
+
+/**
+ * Initializes footprints registry.
+ */
+void init_explore();
+
+/**
+ * Frees all declared footprints.
+ */
+void free_explore();
+
+/**
+ * Client function declaring resources read and written by block, as
+ * comma-separated names (either may be NULL).
+ */
+void c_block_footprint(const char *block, const char *reads, const char *writes);
+
+/**
+ * Client function declaring address range read or written by block.
+ */
+void c_block_range(const char *block, const void *address, size_t size, bool write);
+
+/**
+ * Client function exploring all interleavings of blocks of routines.
+ * Returns number of interleavings which failed assertions.
+ */
+unsigned long c_explore(void (*setup)(), c_thread_routine_t *routines, void **args, unsigned int count);
+
+/**
+ * Client function as above, exploring in given context.
+ */
+unsigned long c_ctx_explore(struct c_context *context, void (*setup)(), c_thread_routine_t *routines, void **args, unsigned int count);
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * gate.c - One-shot wait/publish primitive for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "gate.h"
+
+#define GATE_SPIN 128
+
+#define GATE_WORD(epoch, state) ((int) (((epoch) << GATE_STATE_BITS) | (state)))
+#define GATE_STATE_MASK ((1 << GATE_STATE_BITS) - 1)
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+#ifdef __linux__
+static void futex_wait(int *word, int val)
+{
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake_all(int *word)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#else // no futexes, degrade to yielding
+static void futex_wait(int *word, int val)
+{
+	sched_yield();
+}
+
+static void futex_wake_all(int *word)
+{
+}
+#endif
+
+void gate_init(gate_t *gate)
+{
+	gate->word = GATE_WORD(0, GATE_CLOSED);
+}
+
+void gate_open(gate_t *gate, unsigned int epoch)
+{
+	int old = __atomic_exchange_n(&gate->word, GATE_WORD(epoch, GATE_OPEN), __ATOMIC_ACQ_REL);
+
+	if ((old & GATE_STATE_MASK) == GATE_WAITERS)
+		futex_wake_all(&gate->word);
+}
+
+bool gate_is_open(const gate_t *gate, unsigned int epoch)
+{
+	return __atomic_load_n(&gate->word, __ATOMIC_ACQUIRE) == GATE_WORD(epoch, GATE_OPEN);
+}
+
+void gate_wait(gate_t *gate, unsigned int epoch)
+{
+	int open = GATE_WORD(epoch, GATE_OPEN);
+	int waiters = GATE_WORD(epoch, GATE_WAITERS);
+	int word;
+	int i;
+
+	for (i = 0; i < GATE_SPIN; ++i)
+	{
+		if (gate_is_open(gate, epoch))
+			return;
+		cpu_relax();
+	}
+
+	while ((word = __atomic_load_n(&gate->word, __ATOMIC_ACQUIRE)) != open)
+	{
+		// announce sleeping so gate_open knows to issue wake up, word of stale epoch counts as closed
+		if (word != waiters && !__atomic_compare_exchange_n(&gate->word, &word, waiters, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			continue;
+
+		futex_wait(&gate->word, waiters);
+	}
+}
+
+unsigned int next_epoch(unsigned int epoch)
+{
+	epoch = (epoch + 1) & GATE_EPOCH_MAX;
+
+	return epoch ? epoch : 1;
+}
@@ -0,0 +1,73 @@
+/*
+ * gate.h - One-shot wait/publish primitive for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __GATE_H
+#define __GATE_H
+
+#include <stdbool.h>
+
+/**
+ * Enum representing state space of gate
+ * GATE_CLOSED - closed, nobody sleeps on it
+ * GATE_WAITERS - closed, at least one thread may sleep on it
+ * GATE_OPEN - opened, waiters pass through
+ */
+typedef enum
+{
+	GATE_CLOSED,
+	GATE_WAITERS,
+	GATE_OPEN,
+} GATE_STATE;
+
+/**
+ * Number of low bits of gate word keeping GATE_STATE, the rest keeps epoch.
+ */
+#define GATE_STATE_BITS 2
+
+/**
+ * Largest epoch fitting into gate word, epochs wrap around after it.
+ */
+#define GATE_EPOCH_MAX (~0u >> GATE_STATE_BITS)
+
+/**
+ * One-shot gate: threads wait until it is opened once. Backed by a single
+ * 32-bit futex word on Linux. Every operation is done in some epoch; gate
+ * last touched in other epoch is closed, so bumping epoch closes all gates
+ * using it at once. Gates not shared with reset state simply stay in epoch 0.
+ * word - epoch shifted by GATE_STATE_BITS, ored with GATE_STATE value
+ */
+typedef struct
+{
+	int word;
+} gate_t;
+
+/**
+ * Initializes gate closed in every epoch.
+ */
+void gate_init(gate_t *gate);
+
+/**
+ * Opens gate in epoch and wakes up all waiting threads.
+ */
+void gate_open(gate_t *gate, unsigned int epoch);
+
+/**
+ * Blocks calling thread until gate is opened in epoch. Spins shortly before
+ * sleeping. Nobody may wait on gate while its epoch is bumped.
+ */
+void gate_wait(gate_t *gate, unsigned int epoch);
+
+/**
+ * Returns true if gate was opened in epoch.
+ */
+bool gate_is_open(const gate_t *gate, unsigned int epoch);
+
+/**
+ * Returns epoch following given one. Skips 0, so state initialized to zeros
+ * is never mistaken for current after wrap around.
+ */
+unsigned int next_epoch(unsigned int epoch);
+
+#endif
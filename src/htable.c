@@ -0,0 +1,108 @@
+/*
+ * htable.c - Open-addressing string hash table for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "htable.h"
+#include "utils.h"
+
+#define HTABLE_INITIAL_CAPACITY 64
+
+static htable_array_t *alloc_array(arena_t *arena, size_t capacity)
+{
+	htable_array_t *array = arena_alloc(arena, sizeof(htable_array_t) + capacity * sizeof(htable_slot_t));
+	array->capacity = capacity;
+
+	return array;
+}
+
+void htable_init(htable_t *table, arena_t *arena)
+{
+	table->arena = arena;
+	table->array = alloc_array(arena, HTABLE_INITIAL_CAPACITY);
+	table->size = 0;
+}
+
+/* returns slot holding key or empty slot where key should be placed, sets found accordingly */
+static htable_slot_t *probe(htable_array_t *array, unsigned long hash, const char *key, size_t length, bool *found)
+{
+	size_t mask = array->capacity - 1;
+	htable_slot_t *slot;
+	char *slot_key;
+	size_t i;
+
+	for (i = hash & mask; ; i = (i + 1) & mask)
+	{
+		slot = &array->slots[i];
+		slot_key = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE); // pairs with release in publish_slot
+		*found = slot_key != NULL;
+		if (!slot_key || (slot->hash == hash && strncmp(slot_key, key, length) == 0 && slot_key[length] == '\0'))
+			return slot;
+	}
+}
+
+/* fills empty slot, key is stored last so lock-free readers see complete slot */
+static void publish_slot(htable_slot_t *slot, unsigned long hash, char *key, void *value)
+{
+	slot->hash = hash;
+	slot->value = value;
+	__atomic_store_n(&slot->key, key, __ATOMIC_RELEASE);
+}
+
+static void grow(htable_t *table)
+{
+	htable_array_t *old_array = table->array;
+	htable_array_t *new_array = alloc_array(table->arena, old_array->capacity * 2);
+	htable_slot_t *slot;
+	bool found;
+	size_t i;
+
+	for (i = 0; i < old_array->capacity; ++i)
+	{
+		slot = &old_array->slots[i];
+		if (!slot->key)
+			continue;
+
+		publish_slot(probe(new_array, slot->hash, slot->key, strlen(slot->key), &found), slot->hash, slot->key, slot->value);
+	}
+
+	__atomic_store_n(&table->array, new_array, __ATOMIC_RELEASE);
+}
+
+void *htable_find(const htable_t *table, const char *key)
+{
+	return htable_find_n(table, key, strlen(key));
+}
+
+void *htable_find_n(const htable_t *table, const char *key, size_t length)
+{
+	htable_array_t *array = __atomic_load_n(&table->array, __ATOMIC_ACQUIRE);
+	bool found;
+	htable_slot_t *slot = probe(array, hash_string_n(key, length), key, length, &found);
+
+	return found ? slot->value : NULL;
+}
+
+const char *htable_insert(htable_t *table, const char *key, void *value)
+{
+	return htable_insert_n(table, key, strlen(key), value);
+}
+
+const char *htable_insert_n(htable_t *table, const char *key, size_t length, void *value)
+{
+	unsigned long hash = hash_string_n(key, length);
+	char *interned;
+	bool found;
+
+	if (2 * (table->size + 1) > table->array->capacity) // keep load factor below 1/2
+		grow(table);
+
+	interned = arena_strndup(table->arena, key, length);
+	publish_slot(probe(table->array, hash, interned, length, &found), hash, interned, value);
+	++table->size;
+
+	return interned;
+}
@@ -0,0 +1,88 @@
+/*
+ * htable.h - Open-addressing string hash table for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __HTABLE_H
+#define __HTABLE_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+/**
+ * Single slot of hash table.
+ * hash - cached hash of key
+ * key - interned copy of key string, NULL if slot is empty
+ * value - value associated with key
+ */
+typedef struct
+{
+	unsigned long hash;
+	char *key;
+	void *value;
+} htable_slot_t;
+
+/**
+ * Slots array of hash table together with its size.
+ * capacity - number of slots, always a power of two
+ * slots - slots
+ */
+typedef struct htable_array
+{
+	size_t capacity;
+	htable_slot_t slots[];
+} htable_array_t;
+
+/**
+ * String-keyed hash table with linear probing. Keys are copied into
+ * table-owned storage on insertion (interned), so callers may pass
+ * temporary strings.
+ * Lookups are lock-free and may run concurrently with insertions.
+ * Insertions have to be serialized by the caller, together with other uses
+ * of table's arena. Arrays and keys come from the arena and live as long as
+ * it does, so arrays replaced on growth stay in place until the arena is
+ * released and readers never touch freed memory.
+ * arena - arena of arrays and keys, owned by caller
+ * array - current slots array
+ * size - number of occupied slots
+ */
+typedef struct
+{
+	arena_t *arena;
+	htable_array_t *array;
+	size_t size;
+} htable_t;
+
+/**
+ * Initializes empty hash table allocating from given arena. Table memory is
+ * released together with the arena, values are not touched.
+ */
+void htable_init(htable_t *table, arena_t *arena);
+
+/**
+ * Returns value associated with key or NULL if key is not present.
+ * Lock-free.
+ */
+void *htable_find(const htable_t *table, const char *key);
+
+/**
+ * Like htable_find but key is given as first length characters of key,
+ * which doesn't have to be null-terminated.
+ */
+void *htable_find_n(const htable_t *table, const char *key, size_t length);
+
+/**
+ * Inserts key (which must not be present yet) with value.
+ * Returns interned copy of key which lives as long as the table.
+ * Should be called with caller's table lock taken.
+ */
+const char *htable_insert(htable_t *table, const char *key, void *value);
+
+/**
+ * Like htable_insert but key is given as first length characters of key.
+ * Interned copy is null-terminated.
+ */
+const char *htable_insert_n(htable_t *table, const char *key, size_t length, void *value);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * output.c - Buffered output for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "coconut.h"
+#include "output.h"
+#include "utils.h"
+
+static list_t rings_list; // head only, rings are big
+static pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER; // guards rings_list and consuming side of rings
+static pthread_t flusher_thread;
+static pthread_cond_t flusher_cond;
+static pthread_key_t orphan_key; // its destructor marks rings of exited threads
+static unsigned long output_generation = 0; // bumped when rings are freed, invalidates cached rings
+static __thread output_ring_t *self_ring = NULL;
+static __thread unsigned long self_generation = 0;
+
+static void ring_orphaned(void *data)
+{
+	output_ring_t *ring = data;
+
+	__atomic_store_n(&ring->orphaned, true, __ATOMIC_RELEASE);
+}
+
+/* should be called with output_mutex taken */
+static output_ring_t *find_drained_orphan()
+{
+	output_ring_t *ring;
+	list_t *it;
+
+	list_for_each(it, &rings_list)
+	{
+		ring = list_entry(it, output_ring_t, head);
+		if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE) && ring->read == ring->write)
+			return ring;
+	}
+
+	return NULL;
+}
+
+static output_ring_t *get_self_ring()
+{
+	unsigned long generation = __atomic_load_n(&output_generation, __ATOMIC_ACQUIRE);
+	output_ring_t *ring;
+
+	if (self_ring && self_generation == generation)
+		return self_ring;
+
+	pthread_mutex_lock(&output_mutex);
+	ring = find_drained_orphan();
+	if (!ring)
+	{
+		ring = aligned_alloc(CACHE_LINE_SIZE, sizeof(output_ring_t));
+		ring->read = ring->write = 0;
+		list_add_tail(&ring->head, &rings_list);
+	}
+	__atomic_store_n(&ring->orphaned, false, __ATOMIC_RELEASE);
+	pthread_setspecific(orphan_key, ring);
+	pthread_mutex_unlock(&output_mutex);
+
+	self_ring = ring;
+	self_generation = generation;
+
+	return ring;
+}
+
+void voutput(const char *format, va_list args)
+{
+	output_ring_t *ring;
+	output_record_t *record;
+	unsigned long write;
+	int length;
+	va_list args_copy;
+
+	if (!running)
+		return;
+
+	ring = get_self_ring();
+	write = ring->write; // written by this thread only
+
+	if (write - __atomic_load_n(&ring->read, __ATOMIC_ACQUIRE) == OUTPUT_RING_SIZE) // full -> drain it in place
+		flush_output();
+
+	record = &ring->records[write & (OUTPUT_RING_SIZE - 1)];
+	record->timestamp = monotonic_ns();
+	record->long_text = NULL;
+
+	va_copy(args_copy, args);
+	length = vsnprintf(record->text, OUTPUT_TEXT_SIZE, format, args);
+	if (length >= OUTPUT_TEXT_SIZE && (record->long_text = malloc(length + 1)))
+		vsnprintf(record->long_text, length + 1, format, args_copy);
+	va_end(args_copy);
+
+	__atomic_store_n(&ring->write, write + 1, __ATOMIC_RELEASE);
+
+	// ring getting full -> don't wait for next flusher tick
+	if (write + 1 - __atomic_load_n(&ring->read, __ATOMIC_ACQUIRE) == OUTPUT_RING_SIZE / 2)
+		pthread_cond_signal(&flusher_cond);
+}
+
+void c_output(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	voutput(format, args);
+	va_end(args);
+}
+
+/* should be called with output_mutex taken */
+static void drain_rings()
+{
+	output_ring_t *ring;
+	output_ring_t *oldest;
+	output_record_t *record;
+	list_t *it;
+
+	list_for_each(it, &rings_list)
+	{
+		ring = list_entry(it, output_ring_t, head);
+		ring->flush_end = __atomic_load_n(&ring->write, __ATOMIC_ACQUIRE);
+	}
+
+	// every ring is ordered by itself, so merging their heads gives global order
+	for (;;)
+	{
+		oldest = NULL;
+		list_for_each(it, &rings_list)
+		{
+			ring = list_entry(it, output_ring_t, head);
+			if (ring->read != ring->flush_end && (!oldest ||
+				ring->records[ring->read & (OUTPUT_RING_SIZE - 1)].timestamp <
+				oldest->records[oldest->read & (OUTPUT_RING_SIZE - 1)].timestamp))
+				oldest = ring;
+		}
+		if (!oldest)
+			break;
+
+		record = &oldest->records[oldest->read & (OUTPUT_RING_SIZE - 1)];
+		fputs(record->long_text ? record->long_text : record->text, stderr);
+		free(record->long_text);
+		__atomic_store_n(&oldest->read, oldest->read + 1, __ATOMIC_RELEASE);
+	}
+
+	fflush(stderr);
+}
+
+void flush_output()
+{
+	pthread_mutex_lock(&output_mutex);
+	drain_rings();
+	pthread_mutex_unlock(&output_mutex);
+}
+
+static void *flusher(void *dummy)
+{
+	unsigned long long wake;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&output_mutex);
+	while (running)
+	{
+		wake = monotonic_ns() + OUTPUT_FLUSH_INTERVAL;
+		deadline.tv_sec = wake / 1000000000ULL;
+		deadline.tv_nsec = wake % 1000000000ULL;
+		pthread_cond_timedwait(&flusher_cond, &output_mutex, &deadline);
+		drain_rings();
+	}
+	pthread_mutex_unlock(&output_mutex);
+
+	return NULL;
+}
+
+/* program may exit without c_free, buffered diagnostics must not get lost then */
+static void flush_at_exit()
+{
+	flush_output();
+}
+
+void init_output()
+{
+	static bool exit_flush_registered = false; // init_output runs with contexts_mutex taken
+	pthread_condattr_t cond_attr;
+
+	INIT_LIST_HEAD(&rings_list);
+	if (!exit_flush_registered)
+	{
+		atexit(flush_at_exit);
+		exit_flush_registered = true;
+	}
+	pthread_key_create(&orphan_key, ring_orphaned);
+
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&flusher_cond, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+
+	pthread_create(&flusher_thread, NULL, flusher, NULL);
+}
+
+void free_output()
+{
+	list_t *it, *tmp_it;
+	output_ring_t *tmp;
+
+	pthread_mutex_lock(&output_mutex);
+	pthread_cond_signal(&flusher_cond);
+	pthread_mutex_unlock(&output_mutex);
+	pthread_join(flusher_thread, NULL);
+	pthread_cond_destroy(&flusher_cond);
+
+	pthread_key_delete(orphan_key); // destructors won't touch freed rings
+
+	pthread_mutex_lock(&output_mutex);
+	drain_rings();
+	list_for_each_safe(it, tmp_it, &rings_list)
+	{
+		tmp = list_entry(it, output_ring_t, head);
+		list_del(it);
+		free(tmp);
+	}
+	__atomic_add_fetch(&output_generation, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&output_mutex);
+}
@@ -0,0 +1,86 @@
+/*
+ * output.h - Buffered output for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __OUTPUT_H
+#define __OUTPUT_H
+
+#include <stdarg.h>
+
+#include "list.h"
+#include "threads.h"
+
+/**
+ * Number of records in per-thread ring, must be a power of two.
+ */
+#define OUTPUT_RING_SIZE 256
+
+/**
+ * Size of record text buffer. Longer messages are stored on heap.
+ */
+#define OUTPUT_TEXT_SIZE 240
+
+/**
+ * Interval of background flushing in nanoseconds.
+ */
+#define OUTPUT_FLUSH_INTERVAL 10000000ULL
+
+/**
+ * Single pre-formatted message.
+ * timestamp - monotonic time of c_output call in nanoseconds
+ * long_text - heap copy of message if it didn't fit in text, NULL otherwise
+ * text - message
+ */
+typedef struct
+{
+	unsigned long long timestamp;
+	char *long_text;
+	char text[OUTPUT_TEXT_SIZE];
+} output_record_t;
+
+/**
+ * Single-producer single-consumer ring of records. Only owning thread
+ * writes records and write index, only flusher (holding output_mutex)
+ * reads them and moves read index. Indices live on separate cache lines.
+ * head - list head
+ * orphaned - owning thread exited, ring may be taken over once drained
+ * flush_end - write index snapshot of current flush, used by flusher only
+ * read - index of oldest unflushed record
+ * write - index of next record to write
+ * records - records
+ */
+typedef struct output_ring
+{
+	list_t head;
+	bool orphaned;
+	unsigned long flush_end;
+	unsigned long read __attribute__ ((aligned (CACHE_LINE_SIZE)));
+	unsigned long write __attribute__ ((aligned (CACHE_LINE_SIZE)));
+	output_record_t records[OUTPUT_RING_SIZE];
+} __attribute__ ((aligned (CACHE_LINE_SIZE))) output_ring_t;
+
+/**
+ * Initializes rings list and starts background flusher.
+ * Should be called with running already set.
+ */
+void init_output();
+
+/**
+ * Like c_output, but takes arguments as va_list.
+ */
+void voutput(const char *format, va_list args);
+
+/**
+ * Writes all buffered records to stderr ordered by timestamp. Also run at
+ * exit of program, which may end without c_free.
+ */
+void flush_output();
+
+/**
+ * Stops flusher, flushes remaining records and frees all rings.
+ * Should be called with running already cleared.
+ */
+void free_output();
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * parallel.c - Running interleavings in parallel processes for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "blocks.h"
+#include "coconut.h"
+#include "context.h"
+#include "parallel.h"
+#include "utils.h"
+
+#define DEFAULT_PARALLEL_TIMEOUT 60
+
+static unsigned int parallel_jobs = 0; // 0 -> number of online cores
+static unsigned int parallel_timeout = DEFAULT_PARALLEL_TIMEOUT; // in seconds, 0 -> no limit
+
+void c_set_parallel_jobs(unsigned int jobs)
+{
+	parallel_jobs = jobs;
+}
+
+void c_set_parallel_timeout(unsigned int seconds)
+{
+	parallel_timeout = seconds;
+}
+
+static unsigned int jobs_count()
+{
+	long cores;
+
+	if (parallel_jobs)
+		return parallel_jobs;
+
+	cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return cores > 0 ? cores : 1;
+}
+
+/* body of forked process, fills its arena slot and never returns */
+static void run_child(void (*test)(void *), void *arg, const char *interleaving, c_result_t *result, pid_t group)
+{
+	unsigned long long start;
+	bool scheduled;
+
+	setpgid(0, group); // also done by parent, whichever runs first
+	alarm(parallel_timeout); // SIGALRM kills hanging process, parent tells it from crash
+
+	c_set_context(NULL); // forking thread might have used other context
+	c_init();
+	capture_assertion(&default_context, result->message, sizeof(result->message));
+
+	// test running unordered would pass for wrong reason
+	scheduled = interleaving && *interleaving && set_blocks_interleaving(&default_context, interleaving, 0, result->message, sizeof(result->message));
+	if (!interleaving || !*interleaving)
+	{
+		c_output("Empty interleaving given to run. Skipping...\n");
+		snprintf(result->message, sizeof(result->message), "Empty interleaving");
+	}
+
+	if (scheduled)
+	{
+		start = monotonic_ns();
+		test(arg);
+		result->duration_ns = monotonic_ns() - start;
+		result->assertions_failed = __atomic_load_n(&default_context.assertions_failed, __ATOMIC_ACQUIRE);
+	}
+
+	c_free();
+	fflush(NULL);
+	_exit(scheduled && !result->assertions_failed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/* fills result of reaped worker and reports failure, returns true if it passed */
+static bool finish_worker(worker_t *worker, c_result_t *result, int status)
+{
+	if (WIFSIGNALED(status))
+	{
+		result->signal = WTERMSIG(status);
+		result->timed_out = result->signal == SIGALRM;
+		result->duration_ns = monotonic_ns() - worker->started;
+	}
+	result->passed = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS && !result->assertions_failed;
+
+	// nothing else runs in this process, so output goes straight to stderr
+	if (result->timed_out)
+		fprintf(stderr, "Interleaving %s timed out.\n", worker->interleaving);
+	else if (result->signal)
+		fprintf(stderr, "Interleaving %s crashed with signal %d.\n", worker->interleaving, result->signal);
+	else if (!result->passed)
+		fprintf(stderr, "Interleaving %s failed.\n", worker->interleaving);
+
+	free(worker->interleaving);
+	worker->interleaving = NULL;
+	worker->pid = 0;
+
+	return result->passed;
+}
+
+unsigned long c_run_parallel(void (*test)(void *), void *arg, c_interleaving_generator_t generator, void *state, c_result_t *results, unsigned long capacity)
+{
+	unsigned int jobs = jobs_count();
+	c_result_t *arena;
+	worker_t *workers;
+	const char *interleaving;
+	bool exhausted = false;
+	unsigned int active = 0;
+	unsigned long index = 0;
+	unsigned long failed = 0;
+	unsigned int w;
+	pid_t group = 0; // process group of workers, 0 until first one starts it
+	pid_t pid;
+	int status;
+
+	if (running) // forking would leave watchdog and output threads behind in children
+	{
+		c_output("Parallel run has to be started before c_init or after c_free. Skipping...\n");
+		return 0;
+	}
+
+	// one result slot per worker, shared with children
+	arena = mmap(NULL, sizeof(c_result_t) * jobs, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (arena == MAP_FAILED)
+	{
+		fprintf(stderr, "Cannot map results arena for parallel run. Skipping...\n");
+		return 0;
+	}
+	workers = calloc(jobs, sizeof(worker_t));
+
+	for (;;)
+	{
+		// keep all workers busy
+		for (w = 0; w < jobs && !exhausted; ++w)
+		{
+			if (workers[w].pid)
+				continue;
+
+			if (!(interleaving = generator(state)))
+			{
+				exhausted = true;
+				break;
+			}
+
+			memset(&arena[w], 0, sizeof(c_result_t));
+			arena[w].index = index++;
+			workers[w].interleaving = strdup(interleaving);
+			workers[w].started = monotonic_ns();
+
+			if (!active) // group dies with its last member, next worker starts new one
+				group = 0;
+
+			fflush(NULL); // don't let children repeat buffered output
+			pid = fork();
+			if (pid == 0)
+				run_child(test, arg, interleaving, &arena[w], group);
+			if (pid < 0)
+			{
+				fprintf(stderr, "Cannot fork for interleaving %s. Skipping...\n", interleaving);
+				--index;
+				free(workers[w].interleaving);
+				workers[w].interleaving = NULL;
+				exhausted = true;
+				break;
+			}
+
+			setpgid(pid, group);
+			if (!group)
+				group = pid;
+			workers[w].pid = pid;
+			++active;
+		}
+
+		if (!active)
+			break;
+
+		pid = waitpid(-group, &status, 0); // children of tested program are none of our business
+		if (pid < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (w = 0; w < jobs && workers[w].pid != pid; ++w);
+		if (w == jobs) // not ours
+			continue;
+
+		--active;
+		if (!finish_worker(&workers[w], &arena[w], status))
+			++failed;
+		if (results && arena[w].index < capacity)
+			results[arena[w].index] = arena[w];
+	}
+
+	fprintf(stderr, "Ran %lu interleavings in %u processes, %lu failed.\n", index, jobs, failed);
+
+	free(workers);
+	munmap(arena, sizeof(c_result_t) * jobs);
+
+	return failed;
+}
+
+/**
+ * State of generator walking list of interleavings.
+ * interleavings - the list
+ * count - its length
+ * next - index of next interleaving to return
+ */
+typedef struct
+{
+	const char **interleavings;
+	unsigned long count;
+	unsigned long next;
+} list_generator_t;
+
+static const char *next_from_list(void *state)
+{
+	list_generator_t *list = state;
+
+	return list->next < list->count ? list->interleavings[list->next++] : NULL;
+}
+
+unsigned long c_run_interleavings(void (*test)(void *), void *arg, const char **interleavings, unsigned long count, c_result_t *results)
+{
+	list_generator_t list = { interleavings, count, 0 };
+
+	return c_run_parallel(test, arg, next_from_list, &list, results, count);
+}
@@ -0,0 +1,51 @@
+/*
+ * parallel.h - Running interleavings in parallel processes for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __PARALLEL_H
+#define __PARALLEL_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "coconut_pub.h"
+
+/**
+ * Worker of parallel run, i.e. slot of results arena.
+ * pid - pid of process running interleaving, 0 if slot is free
+ * started - time of fork
+ * interleaving - copy of interleaving being run
+ */
+typedef struct
+{
+	pid_t pid;
+	unsigned long long started;
+	char *interleaving;
+} worker_t;
+
+/**
+ * Client function setting number of parallel processes, 0 means number of
+ * online cores.
+ */
+void c_set_parallel_jobs(unsigned int jobs);
+
+/**
+ * Client function setting time limit of single interleaving in seconds,
+ * 0 means no limit.
+ */
+void c_set_parallel_timeout(unsigned int seconds);
+
+/**
+ * Client function running test once per generated interleaving, each in its
+ * own process. Returns number of interleavings which failed.
+ */
+unsigned long c_run_parallel(void (*test)(void *), void *arg, c_interleaving_generator_t generator, void *state, c_result_t *results, unsigned long capacity);
+
+/**
+ * Client function running test once per interleaving of the list, each in
+ * its own process. Returns number of interleavings which failed.
+ */
+unsigned long c_run_interleavings(void (*test)(void *), void *arg, const char **interleavings, unsigned long count, c_result_t *results);
+
+#endif
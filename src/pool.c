@@ -0,0 +1,184 @@
+/*
+ * pool.c - Threads pool running tested routines for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blocks.h"
+#include "coconut.h"
+#include "context.h"
+#include "events.h"
+#include "pool.h"
+#include "threads.h"
+#include "utils.h"
+
+static void *pool_worker(void *arg)
+{
+	pool_worker_t *worker = arg;
+	context_t *context = worker->context;
+	pool_t *pool = &context->pool;
+	unsigned int dropped;
+
+	c_set_context(context);
+
+	for (;;)
+	{
+		gate_wait(&worker->start, 0);
+		gate_init(&worker->start); // dispatcher opens it again only after whole run is done
+
+		if (__atomic_load_n(&pool->stopping, __ATOMIC_ACQUIRE))
+			break;
+
+		unpark_self(context);
+		worker->routine(worker->arg);
+		if ((dropped = drop_open_blocks())) // next run on this worker would end them otherwise
+			c_output("Routine returned with %u blocks not ended. Possible malfunctions.\n", dropped);
+		park_self(context); // idle worker mustn't look runnable to watchdog
+
+		if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL) == 0)
+			gate_open(&pool->done, 0);
+	}
+
+	return NULL;
+}
+
+void init_pool(context_t *context)
+{
+	pool_t *pool = &context->pool;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pool->workers = NULL;
+	pool->count = 0;
+	pool->pending = 0;
+	pool->stopping = false;
+	pool->runs = 0;
+	pool->timeout_ns = 0;
+}
+
+void free_pool(context_t *context)
+{
+	pool_t *pool = &context->pool;
+	unsigned int i;
+
+	__atomic_store_n(&pool->stopping, true, __ATOMIC_RELEASE);
+	for (i = 0; i < pool->count; ++i)
+		gate_open(&pool->workers[i]->start, 0);
+	for (i = 0; i < pool->count; ++i)
+	{
+		pthread_join(pool->workers[i]->id, NULL);
+		free(pool->workers[i]);
+	}
+
+	free(pool->workers);
+	pool->workers = NULL;
+	pool->count = 0;
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+/* should be called with pool mutex taken */
+static void grow_pool(context_t *context, unsigned int count)
+{
+	pool_t *pool = &context->pool;
+	pool_worker_t *worker;
+
+	if (count <= pool->count)
+		return;
+
+	pool->workers = realloc(pool->workers, sizeof(pool_worker_t *) * count);
+	while (pool->count < count)
+	{
+		worker = malloc(sizeof(pool_worker_t));
+		worker->context = context;
+		gate_init(&worker->start);
+		pthread_create(&worker->id, NULL, pool_worker, worker);
+		pool->workers[pool->count++] = worker;
+	}
+}
+
+void pool_run(context_t *context, c_thread_routine_t *routines, void **args, unsigned int count)
+{
+	pool_t *pool = &context->pool;
+	pool_worker_t *worker;
+	unsigned int i;
+
+	if (!count)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	grow_pool(context, count);
+	gate_init(&pool->done);
+	__atomic_store_n(&pool->pending, count, __ATOMIC_RELEASE);
+
+	for (i = 0; i < count; ++i)
+	{
+		worker = pool->workers[i];
+		worker->routine = routines[i];
+		worker->arg = args ? args[i] : NULL;
+		gate_open(&worker->start, 0);
+	}
+
+	gate_wait(&pool->done, 0);
+
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void c_ctx_set_schedule_timeout(context_t *context, unsigned long long timeout_ns)
+{
+	context->pool.timeout_ns = timeout_ns;
+}
+
+void c_set_schedule_timeout(unsigned long long timeout_ns)
+{
+	c_ctx_set_schedule_timeout(current_context(), timeout_ns);
+}
+
+c_result_t c_ctx_run_schedule(context_t *context, c_thread_routine_t *routines, void **args, unsigned int count, const char *interleaving)
+{
+	c_result_t result;
+	unsigned long assertions;
+	unsigned long expired;
+	unsigned long long start;
+
+	memset(&result, 0, sizeof(result));
+	if (!context->running)
+		return result;
+
+	result.index = __atomic_fetch_add(&context->pool.runs, 1, __ATOMIC_ACQ_REL);
+
+	// routines running unordered would pass for wrong reason
+	if (!interleaving || !*interleaving)
+	{
+		c_output("Empty interleaving given to run. Skipping...\n");
+		snprintf(result.message, sizeof(result.message), "Empty interleaving");
+		return result;
+	}
+
+	// rewinding cached schedule and gates is all reset needed, nothing is freed
+	reset_all_events(context);
+	if (!set_blocks_interleaving(context, interleaving, context->pool.timeout_ns, result.message, sizeof(result.message)))
+		return result;
+
+	capture_assertion(context, result.message, sizeof(result.message));
+	assertions = __atomic_load_n(&context->assertions_failed, __ATOMIC_ACQUIRE);
+	expired = __atomic_load_n(&context->schedules_expired, __ATOMIC_ACQUIRE);
+
+	start = monotonic_ns();
+	pool_run(context, routines, args, count);
+	result.duration_ns = monotonic_ns() - start;
+
+	capture_assertion(context, NULL, 0);
+	result.assertions_failed = __atomic_load_n(&context->assertions_failed, __ATOMIC_ACQUIRE) - assertions;
+	result.timed_out = __atomic_load_n(&context->schedules_expired, __ATOMIC_ACQUIRE) != expired;
+	result.passed = result.assertions_failed == 0 && !result.timed_out;
+
+	return result;
+}
+
+c_result_t c_run_schedule(c_thread_routine_t *routines, void **args, unsigned int count, const char *interleaving)
+{
+	return c_ctx_run_schedule(current_context(), routines, args, count, interleaving);
+}
@@ -0,0 +1,97 @@
+/*
+ * pool.h - Threads pool running tested routines for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __POOL_H
+#define __POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "coconut_pub.h"
+#include "gate.h"
+#include "parallel.h"
+
+struct c_context;
+
+/**
+ * Parked thread of pool.
+ * id - thread id
+ * context - context worker works in
+ * start - gate opened when job is assigned or pool is stopping
+ * routine - routine of assigned job
+ * arg - its argument
+ */
+typedef struct
+{
+	pthread_t id;
+	struct c_context *context;
+	gate_t start;
+	c_thread_routine_t routine;
+	void *arg;
+} pool_worker_t;
+
+/**
+ * Threads pool of context. Grows up to the largest number of routines run
+ * at once, workers wait parked between runs instead of exiting.
+ * mutex - serializes runs
+ * workers - workers
+ * count - number of workers
+ * pending - number of routines of current run still running
+ * done - gate opened when last routine of current run returns
+ * stopping - true if workers should exit
+ * runs - number of schedules run by c_run_schedule so far
+ * timeout_ns - time limit of schedule run by c_run_schedule, 0 if none
+ */
+typedef struct
+{
+	pthread_mutex_t mutex;
+	pool_worker_t **workers;
+	unsigned int count;
+	unsigned int pending;
+	gate_t done;
+	bool stopping;
+	unsigned long runs;
+	unsigned long long timeout_ns;
+} pool_t;
+
+/**
+ * Initializes empty pool of context.
+ */
+void init_pool(struct c_context *context);
+
+/**
+ * Stops and joins all workers of context's pool. Workers must be parked.
+ */
+void free_pool(struct c_context *context);
+
+/**
+ * Runs routines on workers of context's pool, each with its args entry (or
+ * NULL), and waits until all of them return.
+ */
+void pool_run(struct c_context *context, c_thread_routine_t *routines, void **args, unsigned int count);
+
+/**
+ * Client function setting time limit of schedules run by c_run_schedule in
+ * nanoseconds, 0 means no limit.
+ */
+void c_set_schedule_timeout(unsigned long long timeout_ns);
+
+/**
+ * Client function as above, working in given context.
+ */
+void c_ctx_set_schedule_timeout(struct c_context *context, unsigned long long timeout_ns);
+
+/**
+ * Client function running routines with given interleaving on pooled
+ * threads and returning result of the run.
+ */
+c_result_t c_run_schedule(c_thread_routine_t *routines, void **args, unsigned int count, const char *interleaving);
+
+/**
+ * Client function as above, working in given context.
+ */
+c_result_t c_ctx_run_schedule(struct c_context *context, c_thread_routine_t *routines, void **args, unsigned int count, const char *interleaving);
+
+#endif
@@ -0,0 +1,194 @@
+/*
+ * schedule.c - Compiled blocks interleavings for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#include <stdio.h>
+
+#include "coconut.h"
+#include "schedule.h"
+#include "utils.h"
+
+block_t *schedule_find_block(const schedule_t *schedule, const char *id)
+{
+	return htable_find(&schedule->index, id);
+}
+
+/* fills CSR of succs by transposing CSR of preds */
+static void build_succs(schedule_t *schedule, arena_t *arena)
+{
+	unsigned int n = schedule->blocks_count;
+	unsigned int *fill = arena_alloc(arena, sizeof(unsigned int) * (n + 1));
+	unsigned int edges = schedule->preds_offsets[n];
+	unsigned int i, j, pred;
+
+	schedule->succs_offsets = arena_alloc(arena, sizeof(unsigned int) * (n + 1));
+	schedule->succs = arena_alloc(arena, sizeof(unsigned int) * (edges ? edges : 1));
+
+	for (j = 0; j < edges; ++j)
+		++schedule->succs_offsets[schedule->preds[j] + 1];
+	for (i = 0; i < n; ++i)
+		schedule->succs_offsets[i + 1] += schedule->succs_offsets[i];
+
+	for (i = 0; i < n; ++i)
+	{
+		for (j = schedule->preds_offsets[i]; j < schedule->preds_offsets[i + 1]; ++j)
+		{
+			pred = schedule->preds[j];
+			schedule->succs[schedule->succs_offsets[pred] + fill[pred]++] = i;
+		}
+	}
+}
+
+schedule_t *compile_schedule(const char *interleaving, arena_t *arena, char *error, size_t error_size)
+{
+	arena_mark_t mark = arena_mark(arena);
+	schedule_t *schedule;
+	interleaving_t parsed;
+	unsigned int *group_of; // group of each block
+	unsigned int g, i, j, n;
+	span_t *name;
+	block_t *block;
+
+	if (!parse_interleaving(interleaving, &parsed, arena))
+	{
+		c_output("Malformed interleaving: %s at position %zu. Interleaving not set.\n", parsed.error, parsed.error_pos);
+		if (error)
+			snprintf(error, error_size, "Malformed interleaving: %s at position %zu", parsed.error, parsed.error_pos);
+		arena_rewind(arena, mark);
+		return NULL;
+	}
+
+	schedule = arena_alloc(arena, sizeof(schedule_t));
+	schedule->blocks = arena_alloc(arena, sizeof(block_t) * (parsed.names_count ? parsed.names_count : 1));
+	schedule->blocks_count = parsed.names_count;
+	htable_init(&schedule->index, arena);
+	group_of = arena_alloc(arena, sizeof(unsigned int) * (parsed.names_count ? parsed.names_count : 1));
+
+	// create blocks, names are unique so i-th name is i-th block
+	for (g = 0; g < parsed.groups_count; ++g)
+	{
+		for (i = parsed.groups[g]; i < parsed.groups[g + 1]; ++i)
+		{
+			name = &parsed.names[i];
+			if (htable_find_n(&schedule->index, interleaving + name->offset, name->length))
+			{
+				c_output("Malformed interleaving: duplicated block %.*s at position %zu. Interleaving not set.\n", (int) name->length, interleaving + name->offset, name->offset);
+				if (error)
+					snprintf(error, error_size, "Malformed interleaving: duplicated block %.*s at position %zu", (int) name->length, interleaving + name->offset, name->offset);
+				arena_rewind(arena, mark);
+				return NULL;
+			}
+
+			block = &schedule->blocks[i];
+			block->schedule = schedule;
+			block->id = htable_insert_n(&schedule->index, interleaving + name->offset, name->length, block);
+			group_of[i] = g;
+		}
+	}
+
+	// each block is preceded by all blocks of previous group
+	schedule->preds_offsets = arena_alloc(arena, sizeof(unsigned int) * (schedule->blocks_count + 1));
+	for (i = 0; i < schedule->blocks_count; ++i)
+	{
+		g = group_of[i];
+		n = g ? parsed.groups[g] - parsed.groups[g - 1] : 0;
+		schedule->blocks[i].preds_count = n;
+		schedule->preds_offsets[i + 1] = schedule->preds_offsets[i] + n;
+	}
+
+	schedule->preds = arena_alloc(arena, sizeof(unsigned int) * (schedule->preds_offsets[schedule->blocks_count] + 1));
+	for (i = 0; i < schedule->blocks_count; ++i)
+	{
+		g = group_of[i];
+		if (g == 0)
+			continue;
+
+		for (j = parsed.groups[g - 1]; j < parsed.groups[g]; ++j)
+			schedule->preds[schedule->preds_offsets[i] + j - parsed.groups[g - 1]] = j;
+	}
+
+	build_succs(schedule, arena);
+
+	reset_schedule(schedule); // zeroed blocks are stale in any epoch but 0
+
+	return schedule;
+}
+
+#define BLOCK_WORD(epoch, state) (((epoch) << GATE_STATE_BITS) | (state))
+#define BLOCK_WORD_EPOCH(word) ((word) >> GATE_STATE_BITS)
+#define BLOCK_WORD_STATE(word) ((BLOCK_STATE) ((word) & ((1u << GATE_STATE_BITS) - 1)))
+
+#define PENDING_WORD(epoch, count) (((uint64_t) (epoch) << 32) | (count))
+#define PENDING_WORD_EPOCH(word) ((unsigned int) ((word) >> 32))
+#define PENDING_WORD_COUNT(word) ((unsigned int) (word))
+
+void reset_schedule(schedule_t *schedule)
+{
+	__atomic_store_n(&schedule->epoch, next_epoch(schedule->epoch), __ATOMIC_RELEASE);
+}
+
+unsigned int schedule_epoch(const schedule_t *schedule)
+{
+	return __atomic_load_n(&schedule->epoch, __ATOMIC_ACQUIRE);
+}
+
+/* decodes state word, stale one means block wasn't touched in current epoch */
+static BLOCK_STATE decode_state(unsigned int word, unsigned int epoch)
+{
+	return BLOCK_WORD_EPOCH(word) == epoch ? BLOCK_WORD_STATE(word) : CREATED;
+}
+
+BLOCK_STATE block_state(const block_t *block)
+{
+	return decode_state(__atomic_load_n(&block->state, __ATOMIC_ACQUIRE), schedule_epoch(block->schedule));
+}
+
+bool enable_block(block_t *block, struct thread *owner_thread)
+{
+	unsigned int epoch = schedule_epoch(block->schedule);
+	unsigned int word = __atomic_load_n(&block->state, __ATOMIC_ACQUIRE);
+
+	do
+	{
+		if (decode_state(word, epoch) != CREATED)
+			return false;
+		// owner of earlier epoch may be recycled already, so new one goes out with the state
+		__atomic_store_n(&block->owner_thread, owner_thread, __ATOMIC_RELAXED);
+	}
+	while (!__atomic_compare_exchange_n(&block->state, &word, BLOCK_WORD(epoch, ENABLED), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	return true;
+}
+
+void start_block(block_t *block)
+{
+	unsigned int epoch = schedule_epoch(block->schedule);
+	unsigned int word = BLOCK_WORD(epoch, ENABLED);
+
+	// block could be finished meanwhile by watchdog, don't resurrect it
+	__atomic_compare_exchange_n(&block->state, &word, BLOCK_WORD(epoch, STARTED), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+bool mark_block_finished(block_t *block)
+{
+	unsigned int epoch = schedule_epoch(block->schedule);
+
+	return __atomic_exchange_n(&block->state, BLOCK_WORD(epoch, FINISHED), __ATOMIC_ACQ_REL) != BLOCK_WORD(epoch, FINISHED);
+}
+
+bool release_pred(block_t *block)
+{
+	unsigned int epoch = schedule_epoch(block->schedule);
+	uint64_t word = __atomic_load_n(&block->pending, __ATOMIC_ACQUIRE);
+	unsigned int count;
+
+	do
+	{
+		// first release in epoch starts counting from all preds
+		count = PENDING_WORD_EPOCH(word) == epoch ? PENDING_WORD_COUNT(word) : block->preds_count;
+	}
+	while (!__atomic_compare_exchange_n(&block->pending, &word, PENDING_WORD(epoch, count - 1), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	return count == 1;
+}
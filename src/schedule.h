@@ -0,0 +1,143 @@
+/*
+ * schedule.h - Compiled blocks interleavings for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __SCHEDULE_H
+#define __SCHEDULE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "gate.h"
+#include "htable.h"
+
+/**
+ * Enum representing state space of block in Coconut
+ * CREATED - created by c_set_blocks_interleaving
+ * ENABLED - visited by c_begin_block
+ * STARTED - started in c_begin_block
+ * FINISHED - finished in c_end_block
+ */
+typedef enum
+{
+	CREATED,
+	ENABLED,
+	STARTED,
+	FINISHED,
+} BLOCK_STATE;
+
+struct schedule;
+struct thread;
+
+/**
+ * Block representation in Coconut
+ * schedule - schedule block belongs to
+ * owner - owning thread id
+ * owner_thread - owning thread, set together with ENABLED state
+ * ready - gate opened in schedule's epoch when all preceding blocks finished, never waited on if there are none
+ * id - id of block, interned in schedule's index
+ * state - current state, packed with epoch it was set in, see block_state
+ * preds_count - number of preceding blocks
+ * pending - number of preceding blocks that haven't finished yet in lower half, epoch it was counted in in upper half
+ * trace_id - id interned by trace recorder, 0 until first traced
+ * stats - blocked time histogram of id, NULL until first begun
+ */
+typedef struct block
+{
+	struct schedule *schedule;
+	pthread_t owner;
+	struct thread *owner_thread;
+	gate_t ready;
+	const char *id;
+	unsigned int state;
+	unsigned int preds_count;
+	uint64_t pending;
+	uint32_t trace_id;
+	struct histogram *stats;
+} block_t;
+
+/**
+ * Interleaving compiled into DAG of blocks. Edges are kept in CSR form:
+ * preds of block i are preds[preds_offsets[i]] .. preds[preds_offsets[i + 1] - 1],
+ * likewise for succs. Blocks are referred to by index in blocks array.
+ * Block state and pending counter set in other epoch than schedule's are
+ * stale and read as CREATED and preds_count, so schedule is rewound by
+ * bumping its epoch.
+ * interleaving - source interleaving string
+ * epoch - current epoch of blocks
+ * index - block id to block_t lookup table
+ * blocks_count - number of blocks
+ * blocks - blocks array
+ * preds_offsets - offsets of preds of each block, blocks_count + 1 entries
+ * preds - preds indices
+ * succs_offsets - offsets of succs of each block, blocks_count + 1 entries
+ * succs - succs indices
+ */
+typedef struct schedule
+{
+	const char *interleaving;
+	unsigned int epoch;
+	htable_t index;
+	unsigned int blocks_count;
+	block_t *blocks;
+	unsigned int *preds_offsets;
+	unsigned int *preds;
+	unsigned int *succs_offsets;
+	unsigned int *succs;
+} schedule_t;
+
+/**
+ * Compiles interleaving into new schedule in its initial state, allocated
+ * from arena together with parsing scratch. Reports malformed interleaving,
+ * also into error buffer of given size if it isn't NULL, takes back
+ * everything it allocated and returns NULL.
+ */
+schedule_t *compile_schedule(const char *interleaving, arena_t *arena, char *error, size_t error_size);
+
+/**
+ * Brings all blocks of schedule back to CREATED state in constant time.
+ * Nobody may be inside its blocks meanwhile.
+ */
+void reset_schedule(schedule_t *schedule);
+
+/**
+ * Returns current epoch of schedule.
+ */
+unsigned int schedule_epoch(const schedule_t *schedule);
+
+/**
+ * Returns state of block in current epoch of its schedule.
+ */
+BLOCK_STATE block_state(const block_t *block);
+
+/**
+ * Moves block from CREATED to ENABLED state owned by owner_thread, which is
+ * visible to anyone who sees the new state. Returns false if block was
+ * visited already, only one thread can claim block.
+ */
+bool enable_block(block_t *block, struct thread *owner_thread);
+
+/**
+ * Moves block from ENABLED to STARTED state, does nothing in other states.
+ */
+void start_block(block_t *block);
+
+/**
+ * Moves block to FINISHED state. Returns false if it was finished already.
+ */
+bool mark_block_finished(block_t *block);
+
+/**
+ * Counts finish of one of block's preds. Returns true if it was the last one.
+ */
+bool release_pred(block_t *block);
+
+/**
+ * Finds block by id. Returns NULL if not found. Lock-free.
+ */
+block_t *schedule_find_block(const schedule_t *schedule, const char *id);
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * stats.c - Blocked time statistics for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "coconut.h"
+#include "htable.h"
+#include "stats.h"
+
+static histogram_t histograms_list;
+static htable_t histograms_tables[2]; // per STATS_KIND, id -> histogram
+static arena_t stats_arena; // histograms and their tables, guarded by stats_mutex
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER; // serializes creation of histograms
+static bool stats_dump = false;
+static bool stats_requested = false; // by c_enable_stats, survives c_free
+bool stats_enabled = false;
+static const char *kind_names[] = { "block", "event" };
+
+static unsigned int bucket_of(uint64_t value)
+{
+	unsigned int exponent;
+
+	if (value < HISTOGRAM_SUB_COUNT)
+		return value;
+
+	exponent = 63 - __builtin_clzll(value); // at least HISTOGRAM_SUB_BITS
+	return HISTOGRAM_SUB_COUNT + (exponent - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_COUNT +
+		((value >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_COUNT - 1));
+}
+
+/* returns greatest value falling into bucket */
+static uint64_t bucket_top(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < HISTOGRAM_SUB_COUNT)
+		return bucket;
+
+	shift = (bucket - HISTOGRAM_SUB_COUNT) / HISTOGRAM_SUB_COUNT;
+	return (((uint64_t) HISTOGRAM_SUB_COUNT + bucket % HISTOGRAM_SUB_COUNT + 1) << shift) - 1;
+}
+
+void init_stats()
+{
+	char *stats_str;
+	int stats_val;
+
+	INIT_LIST_HEAD(&histograms_list.head);
+	arena_init(&stats_arena);
+	htable_init(&histograms_tables[STATS_BLOCK], &stats_arena);
+	htable_init(&histograms_tables[STATS_EVENT], &stats_arena);
+
+	stats_str = getenv("C_STATS");
+	stats_dump = stats_str && sscanf(stats_str, "%d", &stats_val) == 1 && stats_val;
+	stats_enabled = stats_dump || stats_requested;
+}
+
+void c_enable_stats(bool enable)
+{
+	stats_requested = enable;
+	stats_enabled = enable || stats_dump;
+}
+
+void dump_stats()
+{
+	if (stats_dump)
+		c_print_stats();
+}
+
+void free_stats()
+{
+	list_t *it, *tmp_it;
+
+	histogram_t *histogram;
+	unsigned int i;
+
+	list_for_each_safe(it, tmp_it, &histograms_list.head)
+	{
+		histogram = list_entry(it, histogram_t, head);
+		list_del(it);
+		for (i = 0; i < HISTOGRAM_ROWS; ++i)
+			free(histogram->rows[i]);
+	}
+	arena_free(&stats_arena);
+}
+
+histogram_t *stats_histogram(STATS_KIND kind, histogram_t **cache, const char *id)
+{
+	histogram_t *histogram;
+
+	if (cache && (histogram = __atomic_load_n(cache, __ATOMIC_ACQUIRE)))
+		return histogram;
+
+	histogram = htable_find(&histograms_tables[kind], id);
+	if (!histogram)
+	{
+		pthread_mutex_lock(&stats_mutex);
+		histogram = htable_find(&histograms_tables[kind], id); // recheck, someone could create it meanwhile
+		if (!histogram)
+		{
+			histogram = arena_alloc(&stats_arena, sizeof(histogram_t));
+			histogram->kind = kind;
+			list_add_tail(&histogram->head, &histograms_list.head);
+			histogram->id = htable_insert(&histograms_tables[kind], id, histogram);
+		}
+		pthread_mutex_unlock(&stats_mutex);
+	}
+
+	if (cache)
+		__atomic_store_n(cache, histogram, __ATOMIC_RELEASE);
+
+	return histogram;
+}
+
+/* returns row of buckets, allocating it if needed */
+static uint64_t *get_row(histogram_t *histogram, unsigned int index)
+{
+	uint64_t *row = __atomic_load_n(&histogram->rows[index], __ATOMIC_ACQUIRE);
+	uint64_t *expected = NULL;
+
+	if (row)
+		return row;
+
+	row = calloc(HISTOGRAM_SUB_COUNT, sizeof(uint64_t));
+	if (!__atomic_compare_exchange_n(&histogram->rows[index], &expected, row, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		free(row); // someone else installed it meanwhile
+		row = expected;
+	}
+
+	return row;
+}
+
+void stats_record(histogram_t *histogram, uint64_t ns)
+{
+	uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+	unsigned int bucket = bucket_of(ns);
+
+	__atomic_add_fetch(&get_row(histogram, bucket / HISTOGRAM_SUB_COUNT)[bucket % HISTOGRAM_SUB_COUNT], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&histogram->total, ns, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&histogram->max, &max, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/* returns value at given permille, never above max */
+static uint64_t percentile(const histogram_t *histogram, uint64_t count, uint64_t max, unsigned int permille)
+{
+	uint64_t rank = (count * permille + 999) / 1000;
+	uint64_t seen = 0;
+	uint64_t *row;
+	unsigned int i, j;
+
+	for (i = 0; i < HISTOGRAM_ROWS; ++i)
+	{
+		if (!(row = __atomic_load_n(&histogram->rows[i], __ATOMIC_ACQUIRE)))
+			continue;
+		for (j = 0; j < HISTOGRAM_SUB_COUNT; ++j)
+		{
+			seen += __atomic_load_n(&row[j], __ATOMIC_RELAXED);
+			if (seen >= rank && seen > 0)
+				return bucket_top(i * HISTOGRAM_SUB_COUNT + j) < max ? bucket_top(i * HISTOGRAM_SUB_COUNT + j) : max;
+		}
+	}
+
+	return max;
+}
+
+static void fill_stats(const histogram_t *histogram, c_stats_t *stats)
+{
+	stats->count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+	stats->total = __atomic_load_n(&histogram->total, __ATOMIC_RELAXED);
+	stats->max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+	stats->p50 = percentile(histogram, stats->count, stats->max, 500);
+	stats->p99 = percentile(histogram, stats->count, stats->max, 990);
+}
+
+static bool get_stats(STATS_KIND kind, const char *id, c_stats_t *stats)
+{
+	histogram_t *histogram;
+
+	if (!running)
+		return false;
+
+	histogram = htable_find(&histograms_tables[kind], id);
+	if (!histogram)
+		return false;
+
+	fill_stats(histogram, stats);
+	return true;
+}
+
+bool c_block_stats(const char *id, c_stats_t *stats)
+{
+	return get_stats(STATS_BLOCK, id, stats);
+}
+
+bool c_event_stats(const char *id, c_stats_t *stats)
+{
+	return get_stats(STATS_EVENT, id, stats);
+}
+
+void c_print_stats()
+{
+	histogram_t *histogram;
+	c_stats_t stats;
+	list_t *it;
+
+	if (!running)
+		return;
+
+	pthread_mutex_lock(&stats_mutex);
+	c_output("Blocked time stats (ns):\n");
+	list_for_each(it, &histograms_list.head)
+	{
+		histogram = list_entry(it, histogram_t, head);
+		fill_stats(histogram, &stats);
+		c_output("  %s %s: count %llu, p50 %llu, p99 %llu, max %llu\n", kind_names[histogram->kind], histogram->id, stats.count, stats.p50, stats.p99, stats.max);
+	}
+	pthread_mutex_unlock(&stats_mutex);
+}
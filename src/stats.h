@@ -0,0 +1,128 @@
+/*
+ * stats.h - Blocked time statistics for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "coconut_pub.h"
+#include "list.h"
+
+/**
+ * Number of bits of value kept exactly in every bucket, relative error of
+ * recorded value is below 2^-HISTOGRAM_SUB_BITS.
+ */
+#define HISTOGRAM_SUB_BITS 4
+
+/**
+ * Number of sub-buckets of every power of two.
+ */
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+
+/**
+ * Number of rows of HISTOGRAM_SUB_COUNT buckets covering whole 64-bit range.
+ * Row 0 holds values below HISTOGRAM_SUB_COUNT, every next row one power
+ * of two.
+ */
+#define HISTOGRAM_ROWS (1 + 64 - HISTOGRAM_SUB_BITS)
+
+/**
+ * Enum representing kinds of waits
+ * STATS_BLOCK - waits for preds in c_begin_block
+ * STATS_EVENT - waits in c_wait_event
+ */
+typedef enum
+{
+	STATS_BLOCK,
+	STATS_EVENT,
+} STATS_KIND;
+
+/**
+ * Log-linear histogram of blocked times of single id. Values below
+ * HISTOGRAM_SUB_COUNT have own buckets, every greater power of two range is
+ * split into HISTOGRAM_SUB_COUNT buckets. Rows of buckets are allocated on
+ * first use, so histogram of id that is hardly ever waited for stays small.
+ * All counters are updated with atomic increments and rows are installed
+ * with compare-and-swap, so recording is lock-free.
+ * head - list head
+ * kind - kind of waits
+ * id - interned id
+ * count - number of recorded values
+ * total - sum of recorded values
+ * max - maximum recorded value
+ * rows - rows of bucket counters, NULL until first used
+ */
+typedef struct histogram
+{
+	list_t head;
+	STATS_KIND kind;
+	const char *id;
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	uint64_t *rows[HISTOGRAM_ROWS];
+} histogram_t;
+
+/**
+ * Global variable indicating if blocked times are recorded, i.e. if C_STATS
+ * is set to non-zero or c_enable_stats was called. Waits don't even read
+ * the clock otherwise.
+ */
+extern bool stats_enabled;
+
+/**
+ * Initializes histograms tables. If environmental variable C_STATS is set
+ * to non-zero, stats are recorded and printed by c_free.
+ */
+void init_stats();
+
+/**
+ * Prints stats if requested by C_STATS. Should be called while output is
+ * still running.
+ */
+void dump_stats();
+
+/**
+ * Frees all histograms.
+ */
+void free_stats();
+
+/**
+ * Returns histogram of id of given kind, creating it if needed. cache, if
+ * not NULL, remembers histogram so later calls don't need lookup.
+ */
+histogram_t *stats_histogram(STATS_KIND kind, histogram_t **cache, const char *id);
+
+/**
+ * Records blocked time in nanoseconds. Lock-free.
+ */
+void stats_record(histogram_t *histogram, uint64_t ns);
+
+/**
+ * Client function for turning recording of stats on or off, without C_STATS
+ * recording is off.
+ */
+void c_enable_stats(bool enable);
+
+/**
+ * Client function for getting blocked time stats of block. Returns false if
+ * nobody waited for preds of such block yet.
+ */
+bool c_block_stats(const char *id, c_stats_t *stats);
+
+/**
+ * Client function for getting blocked time stats of event. Returns false if
+ * nobody waited for such event yet.
+ */
+bool c_event_stats(const char *id, c_stats_t *stats);
+
+/**
+ * Client function for outputting stats of all blocks and events.
+ */
+void c_print_stats();
+
+#endif
@@ -5,109 +5,204 @@
 
 #include <stdlib.h>
 
+#include "coconut.h"
+#include "context.h"
 #include "threads.h"
 
-thread_t threads_list;
-pthread_mutex_t threads_list_mutex = PTHREAD_MUTEX_INITIALIZER;
-unsigned long blocked_counter = 0;
+static __thread thread_t *self_thread = NULL;
+static __thread unsigned long self_generation = 0; // generation of context self_thread belongs to
 
-extern int pthread_kill(pthread_t thread, int sig); // should be in signal.h, but buggy on some glibcs
-
-/* should be called with threads_list_mutex taken */
-static thread_t *create_add_thread(pthread_t id)
+static void thread_exited(void *data)
 {
-	thread_t *thread = malloc(sizeof(thread_t));
-	thread->id = id;
-	list_add_tail(&thread->head, &threads_list.head);
+	thread_t *thread = data;
+	context_t *context = thread->context;
 
-	return thread;
+	if (__atomic_exchange_n(&thread->state, THREAD_EXITED, __ATOMIC_ACQ_REL) == THREAD_PARKED) // counted as exited already
+		return;
+
+	__atomic_sub_fetch(&context->live_threads, 1, __ATOMIC_ACQ_REL);
+
+	// exiting thread was the last one not blocked -> the rest may be deadlocked
+	if (__atomic_sub_fetch(&context->runnable_threads, 1, __ATOMIC_ACQ_REL) == 0 && __atomic_load_n(&context->live_threads, __ATOMIC_ACQUIRE) > 0)
+		notify_watchdog(context);
 }
 
-static void free_thread(thread_t *thread)
+void init_threads_list(context_t *context)
 {
-	free(thread);
+	INIT_LIST_HEAD(&context->threads_list.head);
+	pthread_mutex_init(&context->threads_list_mutex, NULL);
+	arena_init(&context->threads_arena);
+	context->runnable_threads = 0;
+	context->live_threads = 0;
+	context->threads_count = 0;
+	pthread_key_create(&context->exit_key, thread_exited);
 }
 
-void free_threads_list()
+/* should be called with threads_list_mutex taken, returns live entry of id or exited entry to recycle */
+static thread_t *find_thread(context_t *context, pthread_t id, bool *registered)
 {
-	list_t *it, *tmp_it;
-	thread_t *tmp;
+	thread_t *exited = NULL;
+	thread_t *thread;
+	THREAD_STATE state;
+	list_t *it;
 
-	list_for_each_safe(it, tmp_it, &threads_list.head)
+	list_for_each(it, &context->threads_list.head)
 	{
-		tmp = list_entry(it, thread_t, head);
-		list_del(it);
-		free_thread(tmp);
+		thread = list_entry(it, thread_t, head);
+		state = __atomic_load_n(&thread->state, __ATOMIC_ACQUIRE);
+		if (state != THREAD_EXITED && pthread_equal(thread->id, id)) // came back from other context
+		{
+			*registered = true;
+			return thread;
+		}
+		if (state == THREAD_EXITED && !exited)
+			exited = thread;
 	}
+
+	*registered = false;
+	return exited;
 }
 
-thread_t *find_thread(const pthread_t id)
+static void revive_thread(context_t *context, thread_t *thread)
 {
-	thread_t *thread;
-	list_t *it;
+	__atomic_add_fetch(&context->live_threads, 1, __ATOMIC_ACQ_REL);
+	__atomic_add_fetch(&context->runnable_threads, 1, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&thread->state, THREAD_LIVE, __ATOMIC_RELEASE);
+}
 
-	list_for_each(it, &threads_list.head)
+/* should be called with threads_list_mutex taken, recycles entries of exited threads */
+static thread_t *find_create_thread(context_t *context, pthread_t id)
+{
+	bool registered;
+	thread_t *thread = find_thread(context, id, &registered);
+
+	if (registered)
 	{
-		thread = list_entry(it, thread_t, head);
-		if (pthread_equal(thread->id, id))
-			return thread;
+		if (__atomic_load_n(&thread->state, __ATOMIC_ACQUIRE) == THREAD_PARKED) // parked elsewhere, counts as live again
+			revive_thread(context, thread);
+		return thread;
+	}
+
+	if (!thread)
+	{
+		thread = arena_alloc_aligned(&context->threads_arena, sizeof(thread_t), CACHE_LINE_SIZE);
+		thread->progress = 0; // recycled entries keep their epoch, so progress_sum never goes back
+		list_add_tail(&thread->head, &context->threads_list.head);
 	}
 
-	return NULL;
+	thread->context = context;
+	thread->id = id;
+	thread->index = ++context->threads_count;
+	thread->waits_block = NULL;
+	thread->waits_event = NULL;
+	__atomic_add_fetch(&context->live_threads, 1, __ATOMIC_ACQ_REL);
+	__atomic_add_fetch(&context->runnable_threads, 1, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&thread->state, THREAD_LIVE, __ATOMIC_RELEASE);
+	pthread_setspecific(context->exit_key, thread);
+
+	return thread;
+}
+
+void free_threads_list(context_t *context)
+{
+	pthread_key_delete(context->exit_key); // destructors won't touch freed entries
+
+	INIT_LIST_HEAD(&context->threads_list.head);
+	arena_free(&context->threads_arena);
+	pthread_mutex_destroy(&context->threads_list_mutex);
+	context->runnable_threads = 0;
+	context->live_threads = 0;
+	context->threads_count = 0;
 }
 
-static bool is_thread_alive(const thread_t *thread)
+thread_t *get_self_thread(context_t *context)
 {
-	return pthread_kill(thread->id, 0) == 0;
+	if (self_thread && self_generation == context->generation)
+		return self_thread;
+
+	pthread_mutex_lock(&context->threads_list_mutex);
+	self_thread = find_create_thread(context, pthread_self());
+	self_generation = context->generation;
+	pthread_mutex_unlock(&context->threads_list_mutex);
+
+	return self_thread;
 }
 
-bool check_liveness()
+unsigned long progress_sum(context_t *context)
 {
-	bool all_dead = true;
+	unsigned long sum = 0;
 	thread_t *thread;
 	list_t *it;
 
-	list_for_each(it, &threads_list.head)
+	list_for_each(it, &context->threads_list.head)
 	{
 		thread = list_entry(it, thread_t, head);
-		if (is_thread_alive(thread))
-		{
-			all_dead = false;
-			if (!thread->blocked) // thread is not blocked and alive -> ok
-				return true;
-		}
+		sum += __atomic_load_n(&thread->progress, __ATOMIC_ACQUIRE);
 	}
 
-	return all_dead; // if all dead -> ok
+	return sum;
 }
 
-void mark_self_blocked()
+/* only owning thread writes its epoch, so no read-modify-write is needed */
+static void bump_progress(thread_t *thread)
 {
-	thread_t *thread;
+	__atomic_store_n(&thread->progress, thread->progress + 1, __ATOMIC_RELEASE);
+}
 
-	__sync_fetch_and_add(&blocked_counter, 1);
+bool check_liveness(context_t *context)
+{
+	// all registered threads exited or at least one is live and not blocked -> ok
+	return __atomic_load_n(&context->live_threads, __ATOMIC_ACQUIRE) == 0 || __atomic_load_n(&context->runnable_threads, __ATOMIC_ACQUIRE) > 0;
+}
 
-	pthread_mutex_lock(&threads_list_mutex);
+void mark_self_blocked(context_t *context, struct block *block, struct event *event)
+{
+	thread_t *thread = get_self_thread(context);
 
-	thread = find_thread(pthread_self());
-	if (thread == NULL) // unregistered thread -> register
-		thread = create_add_thread(pthread_self());
-	thread->blocked = true;
+	__atomic_store_n(&thread->waits_block, block, __ATOMIC_RELAXED); // read by watchdog, published by state store below
+	__atomic_store_n(&thread->waits_event, event, __ATOMIC_RELAXED);
+	bump_progress(thread);
+	__atomic_store_n(&thread->state, THREAD_BLOCKED, __ATOMIC_RELEASE);
 
-	pthread_mutex_unlock(&threads_list_mutex);
+	if (__atomic_sub_fetch(&context->runnable_threads, 1, __ATOMIC_ACQ_REL) == 0) // last runnable thread blocked
+		notify_watchdog(context);
 }
 
-void mark_self_unblocked()
+void mark_self_unblocked(context_t *context)
 {
-	thread_t *thread;
+	thread_t *thread = get_self_thread(context);
+
+	bump_progress(thread);
+	__atomic_add_fetch(&context->runnable_threads, 1, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&thread->state, THREAD_LIVE, __ATOMIC_RELEASE);
+	__atomic_store_n(&thread->waits_block, NULL, __ATOMIC_RELAXED); // watchdog works on its own copies
+	__atomic_store_n(&thread->waits_event, NULL, __ATOMIC_RELAXED);
+}
 
-	__sync_fetch_and_add(&blocked_counter, 1);
+void park_self(context_t *context)
+{
+	thread_t *thread;
 
-	pthread_mutex_lock(&threads_list_mutex);
+	if (!self_thread || self_generation != context->generation) // never registered, nothing to hide
+		return;
 
-	thread = find_thread(pthread_self()); // should not fail
-	thread->blocked = false;
+	thread = self_thread;
+	__atomic_store_n(&thread->state, THREAD_PARKED, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&context->live_threads, 1, __ATOMIC_ACQ_REL);
 
-	pthread_mutex_unlock(&threads_list_mutex);
+	// just like exit, parking of last runnable thread may leave the rest deadlocked
+	if (__atomic_sub_fetch(&context->runnable_threads, 1, __ATOMIC_ACQ_REL) == 0 && __atomic_load_n(&context->live_threads, __ATOMIC_ACQUIRE) > 0)
+		notify_watchdog(context);
 }
 
+void unpark_self(context_t *context)
+{
+	thread_t *thread;
+
+	if (!self_thread || self_generation != context->generation)
+		return;
+
+	thread = self_thread;
+	if (__atomic_load_n(&thread->state, __ATOMIC_ACQUIRE) == THREAD_PARKED)
+		revive_thread(context, thread);
+}
@@ -12,58 +12,105 @@
 #include "list.h"
 
 /**
- * Thread representation in Coconut.
+ * Assumed size of cache line.
+ */
+#define CACHE_LINE_SIZE 64
+
+struct block;
+struct c_context;
+struct event;
+
+/**
+ * Enum representing state space of registered thread
+ * THREAD_LIVE - running, possibly blocked outside of Coconut
+ * THREAD_BLOCKED - blocked on Coconut primitive
+ * THREAD_PARKED - idle pool worker, counts as exited but keeps its entry
+ * THREAD_EXITED - exited, entry may be recycled
+ */
+typedef enum
+{
+	THREAD_LIVE,
+	THREAD_BLOCKED,
+	THREAD_PARKED,
+	THREAD_EXITED,
+} THREAD_STATE;
+
+/**
+ * Thread representation in Coconut. Blocked thread is a node of wait-for
+ * graph, its edges lead through waits_block or waits_event. Entries are
+ * cache line aligned, so fields written by owning thread on every block or
+ * wait don't share lines with other threads.
+ * progress - epoch bumped by owning thread on each block and unblock
  * head - list head
+ * context - context thread is registered in
  * id - thread id (as in PTHREADS)
- * blocked - boolean with current execution state
+ * index - registration number, used in reports
+ * state - current state, accessed atomically
+ * waits_block - block whose preds thread is waiting for, if any
+ * waits_event - event thread is waiting for, if any
  */
-typedef struct
+typedef struct thread
 {
+	unsigned long progress;
 	list_t head;
+	struct c_context *context;
 	pthread_t id;
-	bool blocked;
-} thread_t;
+	unsigned int index;
+	THREAD_STATE state;
+	struct block *waits_block;
+	struct event *waits_event;
+} __attribute__ ((aligned (CACHE_LINE_SIZE))) thread_t;
 
 /**
- * List of all registered threads - threads which used events or blocks.
+ * Initializes context's threads_list and exit tracking of registered threads.
  */
-extern thread_t threads_list;
+void init_threads_list(struct c_context *context);
 
 /**
- * Mutex for threads_list.
+ * Memory freeing function for threads in context's threads_list.
  */
-extern pthread_mutex_t threads_list_mutex;
+void free_threads_list(struct c_context *context);
 
 /**
- * Counter for light registering threads activities. Used to detect deadlocks.
+ * Returns sum of progress epochs of all threads registered in context. Used
+ * to detect deadlocks: sum doesn't change while all threads stay blocked.
+ * Should be called with threads_list_mutex taken.
  */
-extern unsigned long blocked_counter;
+unsigned long progress_sum(struct c_context *context);
 
 /**
- * Memory freeing function for threads in threads_list.
+ * Checks liveness of all threads registered in context. Returns true if all threads finished working or at least one is in running state.
+ * Constant time, exits are tracked by thread-specific data destructor.
  */
-void free_threads_list();
+bool check_liveness(struct c_context *context);
 
 /**
- * Finds thread based on thread id. Returns NULL if not found.
+ * Returns thread_t of calling thread in context. Registers calling thread on
+ * first use, afterwards its thread_t is taken from thread-local cache without
+ * locking as long as thread stays in the same context.
  */
-thread_t *find_thread(const pthread_t id);
+thread_t *get_self_thread(struct c_context *context);
 
 /**
- * Checks liveness of all registered threads. Returns true if all threads finished working or at least one is in running state.
- * Should be called with threads_list_mutex taken.
+ * Marks calling thread as blocked waiting for preds of block or for event
+ * (one of them should be NULL).
  */
-bool check_liveness();
+void mark_self_blocked(struct c_context *context, struct block *block, struct event *event);
 
 /**
- * Marks calling thread as blocked.
- * Should be called with threads_list_mutex taken.
+ * Marks calling thread as unblocked.
  */
-void mark_self_blocked();
+void mark_self_unblocked(struct c_context *context);
 
 /**
- * Marks calling thread as unblocked.
+ * Makes calling thread, if registered in context, count as exited while it
+ * waits for next job of threads pool.
+ */
+void park_self(struct c_context *context);
+
+/**
+ * Makes parked calling thread live again.
  */
-void mark_self_unblocked();
+void unpark_self(struct c_context *context);
 
 #endif
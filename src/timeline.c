@@ -0,0 +1,255 @@
+/*
+ * timeline.c - Chrome trace exporter for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "timeline.h"
+
+/**
+ * Record together with its position, keeps sort stable.
+ */
+typedef struct
+{
+	const trace_record_t *record;
+	size_t seq;
+} timeline_entry_t;
+
+static timeline_buffer_t buffers_list;
+static pthread_mutex_t timeline_mutex = PTHREAD_MUTEX_INITIALIZER; // guards buffers_list
+static unsigned long timeline_generation = 1; // bumped when buffers are freed, invalidates cached buffers
+static __thread timeline_buffer_t *self_buffer = NULL;
+static __thread unsigned long self_generation = 0;
+
+static timeline_chunk_t *alloc_chunk()
+{
+	timeline_chunk_t *chunk = malloc(sizeof(timeline_chunk_t));
+	chunk->next = NULL;
+	chunk->count = 0;
+
+	return chunk;
+}
+
+static timeline_buffer_t *get_self_buffer()
+{
+	unsigned long generation = __atomic_load_n(&timeline_generation, __ATOMIC_ACQUIRE);
+	timeline_buffer_t *buffer;
+
+	if (self_generation == generation)
+		return self_buffer;
+
+	buffer = malloc(sizeof(timeline_buffer_t));
+	buffer->first = buffer->last = alloc_chunk();
+
+	pthread_mutex_lock(&timeline_mutex);
+	list_add_tail(&buffer->head, &buffers_list.head);
+	pthread_mutex_unlock(&timeline_mutex);
+
+	self_buffer = buffer;
+	self_generation = generation;
+
+	return buffer;
+}
+
+void init_timeline()
+{
+	INIT_LIST_HEAD(&buffers_list.head);
+}
+
+void timeline_append(const trace_record_t *record)
+{
+	timeline_buffer_t *buffer = get_self_buffer();
+
+	if (buffer->last->count == TIMELINE_CHUNK_SIZE)
+		buffer->last = buffer->last->next = alloc_chunk();
+
+	buffer->last->records[buffer->last->count++] = *record;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	const timeline_entry_t *x = a, *y = b;
+
+	if (x->record->tsc != y->record->tsc)
+		return x->record->tsc < y->record->tsc ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/* writes "name":"<prefix><id>" with id escaped */
+static void write_name(FILE *file, const char *prefix, const char *id)
+{
+	fprintf(file, "\"name\":\"%s", prefix);
+	for (; *id; ++id)
+	{
+		if (*id == '"' || *id == '\\')
+			fprintf(file, "\\%c", *id);
+		else if ((unsigned char) *id < 0x20)
+			fprintf(file, "\\u%04x", (unsigned char) *id);
+		else
+			fputc(*id, file);
+	}
+	fputc('"', file);
+}
+
+/* writes common part of every trace event */
+static void write_head(FILE *file, const char *phase, const char *category, unsigned int thread, double ts)
+{
+	fprintf(file, ",\n{\"ph\":\"%s\",\"cat\":\"%s\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,", phase, category, thread, ts);
+}
+
+void write_timeline(const char *path, const char *const *names, uint32_t names_count, uint64_t tsc0, double ns_per_tick)
+{
+	timeline_entry_t *entries;
+	const trace_record_t **publishes;
+	const trace_record_t *record;
+	const trace_record_t *publish;
+	timeline_buffer_t *buffer;
+	timeline_chunk_t *chunk;
+	bool *named;
+	const char *id;
+	size_t count = 0;
+	size_t i;
+	unsigned int j;
+	unsigned long flows = 0;
+	list_t *it;
+	FILE *file;
+
+	file = fopen(path, "w");
+	if (!file)
+	{
+		fprintf(stderr, "Cannot write timeline to %s. Skipping...\n", path);
+		return;
+	}
+
+	list_for_each(it, &buffers_list.head)
+		for (chunk = list_entry(it, timeline_buffer_t, head)->first; chunk; chunk = chunk->next)
+			count += chunk->count;
+
+	entries = malloc(sizeof(timeline_entry_t) * (count ? count : 1));
+	count = 0;
+	list_for_each(it, &buffers_list.head)
+	{
+		buffer = list_entry(it, timeline_buffer_t, head);
+		for (chunk = buffer->first; chunk; chunk = chunk->next)
+			for (j = 0; j < chunk->count; ++j)
+			{
+				entries[count].record = &chunk->records[j];
+				entries[count].seq = count;
+				++count;
+			}
+	}
+	qsort(entries, count, sizeof(timeline_entry_t), compare_entries);
+
+	// latest publish of every event seen so far, events may be reset and published again
+	publishes = calloc(names_count ? names_count : 1, sizeof(trace_record_t *));
+
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"Coconut\"}}");
+
+	named = calloc(UINT16_MAX + 1, sizeof(bool));
+	for (i = 0; i < count; ++i)
+	{
+		record = entries[i].record;
+		id = record->id && record->id < names_count && names[record->id] ? names[record->id] : "";
+
+		if (!named[record->thread])
+		{
+			fprintf(file, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"thread #%u\"}}", record->thread, record->thread);
+			named[record->thread] = true;
+		}
+
+#define TS(RECORD) (((double) (RECORD)->tsc - tsc0) * ns_per_tick / 1000.0)
+		switch (record->op)
+		{
+		case TRACE_BLOCK_BEGIN:
+			write_head(file, "B", "block wait", record->thread, TS(record));
+			write_name(file, "waiting for ", id);
+			break;
+		case TRACE_BLOCK_START:
+			write_head(file, "E", "block wait", record->thread, TS(record));
+			write_name(file, "waiting for ", id);
+			fputc('}', file);
+			write_head(file, "B", "block", record->thread, TS(record));
+			write_name(file, "", id);
+			break;
+		case TRACE_BLOCK_END:
+			write_head(file, "E", "block", record->thread, TS(record));
+			write_name(file, "", id);
+			break;
+		case TRACE_EVENT_WAIT:
+			write_head(file, "B", "event", record->thread, TS(record));
+			write_name(file, "waiting for ", id);
+			break;
+		case TRACE_EVENT_WAKE:
+			publish = record->id < names_count ? publishes[record->id] : NULL;
+			if (publish) // arrow from publisher to woken thread
+			{
+				write_head(file, "s", "event", publish->thread, TS(publish));
+				fprintf(file, "\"id\":%lu,", ++flows);
+				write_name(file, "", id);
+				fputc('}', file);
+				write_head(file, "f", "event", record->thread, TS(record));
+				fprintf(file, "\"id\":%lu,\"bp\":\"e\",", flows);
+				write_name(file, "", id);
+				fputc('}', file);
+			}
+			write_head(file, "E", "event", record->thread, TS(record));
+			write_name(file, "waiting for ", id);
+			break;
+		case TRACE_EVENT_PUBLISH:
+			if (record->id < names_count) // records are sorted, so wakes below link to it
+				publishes[record->id] = record;
+			write_head(file, "X", "event", record->thread, TS(record));
+			fprintf(file, "\"dur\":0,");
+			write_name(file, "publish ", id);
+			break;
+		case TRACE_DEADLOCK:
+			write_head(file, "i", "watchdog", record->thread, TS(record));
+			fprintf(file, "\"s\":\"g\",");
+			write_name(file, record->id ? "deadlock, released " : "deadlock, released all", id);
+			break;
+		case TRACE_TIMEOUT:
+			write_head(file, "i", "watchdog", record->thread, TS(record));
+			fprintf(file, "\"s\":\"g\",");
+			write_name(file, "timeout of ", id);
+			break;
+		case TRACE_ASSERT:
+			write_head(file, "i", "assert", record->thread, TS(record));
+			fprintf(file, "\"s\":\"t\",");
+			write_name(file, "assert failed at ", id);
+			break;
+		}
+#undef TS
+		fputc('}', file);
+	}
+
+	fprintf(file, "\n]}\n");
+	fclose(file);
+
+	free(named);
+	free(publishes);
+	free(entries);
+}
+
+void free_timeline()
+{
+	list_t *it, *tmp_it;
+	timeline_buffer_t *buffer;
+	timeline_chunk_t *chunk, *next;
+
+	list_for_each_safe(it, tmp_it, &buffers_list.head)
+	{
+		buffer = list_entry(it, timeline_buffer_t, head);
+		list_del(it);
+		for (chunk = buffer->first; chunk; chunk = next)
+		{
+			next = chunk->next;
+			free(chunk);
+		}
+		free(buffer);
+	}
+	__atomic_add_fetch(&timeline_generation, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,69 @@
+/*
+ * timeline.h - Chrome trace exporter for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __TIMELINE_H
+#define __TIMELINE_H
+
+#include <stdint.h>
+
+#include "list.h"
+#include "trace.h"
+
+/**
+ * Number of records in single chunk of timeline buffer.
+ */
+#define TIMELINE_CHUNK_SIZE 4096
+
+/**
+ * Chunk of records, chunks of thread are singly linked.
+ * next - next chunk, NULL for last one
+ * count - number of used records
+ * records - records
+ */
+typedef struct timeline_chunk
+{
+	struct timeline_chunk *next;
+	unsigned int count;
+	trace_record_t records[TIMELINE_CHUNK_SIZE];
+} timeline_chunk_t;
+
+/**
+ * In-memory buffer of records of single thread. Only owning thread appends,
+ * buffer is read when exporting only, after all threads are done.
+ * head - list head
+ * first - first chunk
+ * last - chunk records are appended to
+ */
+typedef struct timeline_buffer
+{
+	list_t head;
+	timeline_chunk_t *first;
+	timeline_chunk_t *last;
+} timeline_buffer_t;
+
+/**
+ * Initializes buffers list.
+ */
+void init_timeline();
+
+/**
+ * Appends record to buffer of calling thread. Allocates only when chunk
+ * gets full.
+ */
+void timeline_append(const trace_record_t *record);
+
+/**
+ * Writes all buffered records to path as Chrome Trace Event JSON.
+ * names maps interned ids to id strings, tsc0 is time origin and
+ * ns_per_tick converts TSC to nanoseconds.
+ */
+void write_timeline(const char *path, const char *const *names, uint32_t names_count, uint64_t tsc0, double ns_per_tick);
+
+/**
+ * Frees all buffers.
+ */
+void free_timeline();
+
+#endif
@@ -0,0 +1,348 @@
+/*
+ * trace.c - Binary execution trace recorder for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "coconut.h"
+#include "htable.h"
+#include "list.h"
+#include "timeline.h"
+#include "trace.h"
+#include "utils.h"
+
+/**
+ * Mapped ring file of single thread.
+ * head - list head
+ * header - mapped file header
+ * records - mapped records, follow header
+ * size - size of mapping
+ * orphaned - owning thread exited, ring may be taken over by another one
+ */
+typedef struct trace_ring
+{
+	list_t head;
+	trace_header_t *header;
+	trace_record_t *records;
+	size_t size;
+	bool orphaned;
+} trace_ring_t;
+
+bool tracing = false;
+static bool recording_rings = false;
+static char *trace_prefix = NULL;
+static char *timeline_path = NULL;
+static int ids_fd = -1;
+static htable_t ids_table; // id string -> interned id
+static arena_t trace_arena; // ids and rings, guarded by trace_mutex
+static const char **ids_names = NULL; // interned id -> id string, for timeline export
+static uint32_t ids_count = 0;
+static uint32_t ids_capacity = 0;
+static trace_ring_t rings_list;
+static unsigned int rings_count = 0;
+static uint32_t rings_capacity = TRACE_DEFAULT_SIZE;
+static uint16_t threads_count = 0;
+static uint64_t calibration_tsc = 0;
+static uint64_t calibration_ns = 0;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER; // serializes interning and rings creation
+static pthread_key_t orphan_key; // its destructor marks rings of exited threads
+static unsigned long trace_generation = 1; // bumped when rings are freed, invalidates cached rings (and failed creations)
+static __thread trace_ring_t *self_ring = NULL;
+static __thread uint16_t self_index = 0;
+static __thread unsigned long self_generation = 0;
+
+static uint64_t read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return monotonic_ns();
+#endif
+}
+
+static void ring_orphaned(void *data)
+{
+	trace_ring_t *ring = data;
+
+	__atomic_store_n(&ring->orphaned, true, __ATOMIC_RELEASE);
+}
+
+/* should be called with trace_mutex taken */
+static trace_ring_t *create_add_ring()
+{
+	trace_ring_t *ring;
+	char path[4096];
+	size_t size = sizeof(trace_header_t) + (size_t) rings_capacity * sizeof(trace_record_t);
+	void *map;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s.%u", trace_prefix, rings_count);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, size) != 0 || (map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		if (fd >= 0)
+			close(fd);
+		c_output("Cannot create trace file %s. Skipping...\n", path);
+		return NULL;
+	}
+	close(fd); // mapping keeps file alive
+
+	ring = arena_alloc(&trace_arena, sizeof(trace_ring_t));
+	ring->header = map;
+	ring->records = (trace_record_t *) (ring->header + 1);
+	ring->size = size;
+
+	memcpy(ring->header->magic, TRACE_MAGIC, sizeof(ring->header->magic));
+	ring->header->record_size = sizeof(trace_record_t);
+	ring->header->capacity = rings_capacity;
+	ring->header->written = 0;
+	ring->header->tsc0 = calibration_tsc;
+	ring->header->ns0 = calibration_ns;
+	ring->header->tsc1 = read_tsc();
+	ring->header->ns1 = monotonic_ns();
+
+	list_add_tail(&ring->head, &rings_list.head);
+	++rings_count;
+
+	return ring;
+}
+
+/* should be called with trace_mutex taken */
+static trace_ring_t *find_orphan()
+{
+	trace_ring_t *ring;
+	list_t *it;
+
+	list_for_each(it, &rings_list.head)
+	{
+		ring = list_entry(it, trace_ring_t, head);
+		if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE))
+			return ring;
+	}
+
+	return NULL;
+}
+
+/* assigns thread index and ring (if recording rings) to calling thread */
+static void register_self()
+{
+	unsigned long generation = __atomic_load_n(&trace_generation, __ATOMIC_ACQUIRE);
+	trace_ring_t *ring = NULL;
+
+	if (self_generation == generation)
+		return;
+
+	pthread_mutex_lock(&trace_mutex);
+	if (recording_rings)
+	{
+		ring = find_orphan(); // records keep thread index, so rings may be shared over time
+		if (!ring)
+			ring = create_add_ring();
+		if (ring)
+		{
+			ring->orphaned = false;
+			pthread_setspecific(orphan_key, ring);
+		}
+	}
+	self_index = ++threads_count;
+	pthread_mutex_unlock(&trace_mutex);
+
+	self_ring = ring;
+	self_generation = generation;
+}
+
+/* opens ids file and reads rings configuration, returns false on failure */
+static bool init_rings(const char *prefix)
+{
+	char *size_str;
+	unsigned int new_size;
+	unsigned int i;
+	char path[4096];
+
+	size_str = getenv("C_TRACE_SIZE");
+	rings_capacity = TRACE_DEFAULT_SIZE;
+	if (size_str && sscanf(size_str, "%u", &new_size) == 1 && new_size > 0)
+		for (rings_capacity = 1; rings_capacity < new_size && rings_capacity < (1U << 31); rings_capacity <<= 1)
+			;
+
+	snprintf(path, sizeof(path), "%s.ids", prefix);
+	ids_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (ids_fd < 0)
+	{
+		c_output("Cannot create trace file %s. Skipping...\n", path);
+		return false;
+	}
+
+	// rings left by earlier run with more threads would be merged by decoder
+	for (i = 0; ; ++i)
+	{
+		snprintf(path, sizeof(path), "%s.%u", prefix, i);
+		if (unlink(path) != 0)
+			break;
+	}
+
+	trace_prefix = strdup(prefix);
+	INIT_LIST_HEAD(&rings_list.head);
+	rings_count = 0;
+	pthread_key_create(&orphan_key, ring_orphaned);
+
+	return true;
+}
+
+void init_trace()
+{
+	char *prefix_str;
+	char *timeline_str;
+	struct timespec pause = { 0, 2000000 };
+
+	prefix_str = getenv("C_TRACE");
+	recording_rings = prefix_str && *prefix_str && init_rings(prefix_str);
+
+	timeline_str = getenv("C_TIMELINE");
+	if (timeline_str && *timeline_str)
+	{
+		timeline_path = strdup(timeline_str);
+		init_timeline();
+	}
+
+	if (!recording_rings && !timeline_path)
+		return;
+
+	arena_init(&trace_arena);
+	htable_init(&ids_table, &trace_arena);
+	ids_names = NULL;
+	ids_count = 0;
+	ids_capacity = 0;
+	threads_count = 0;
+
+	// second calibration pair is taken by every ring on creation
+	calibration_tsc = read_tsc();
+	calibration_ns = monotonic_ns();
+	nanosleep(&pause, NULL);
+
+	tracing = true;
+}
+
+void free_trace()
+{
+	list_t *it, *tmp_it;
+	trace_ring_t *ring;
+	uint64_t end_tsc = read_tsc();
+	uint64_t end_ns = monotonic_ns();
+
+	if (!tracing)
+		return;
+
+	tracing = false;
+
+	if (timeline_path)
+	{
+		write_timeline(timeline_path, ids_names, ids_count + 1, calibration_tsc, end_tsc > calibration_tsc ? (double) (end_ns - calibration_ns) / (end_tsc - calibration_tsc) : 1.0);
+		free_timeline();
+		free(timeline_path);
+		timeline_path = NULL;
+	}
+
+	if (recording_rings)
+	{
+		pthread_key_delete(orphan_key); // destructors won't touch freed rings
+
+		list_for_each_safe(it, tmp_it, &rings_list.head)
+		{
+			ring = list_entry(it, trace_ring_t, head);
+			list_del(it);
+			ring->header->tsc1 = end_tsc; // longer period gives better calibration
+			ring->header->ns1 = end_ns;
+			munmap(ring->header, ring->size);
+		}
+		close(ids_fd);
+		ids_fd = -1;
+		free(trace_prefix);
+		trace_prefix = NULL;
+		recording_rings = false;
+	}
+
+	arena_free(&trace_arena);
+	free(ids_names);
+	ids_names = NULL;
+	__atomic_add_fetch(&trace_generation, 1, __ATOMIC_RELEASE);
+}
+
+uint32_t trace_intern(uint32_t *cache, const char *id)
+{
+	uint32_t interned;
+
+	if (!tracing || !id)
+		return 0;
+
+	if (cache && (interned = __atomic_load_n(cache, __ATOMIC_RELAXED)))
+		return interned;
+
+	interned = (uintptr_t) htable_find(&ids_table, id);
+	if (!interned)
+	{
+		pthread_mutex_lock(&trace_mutex);
+		interned = (uintptr_t) htable_find(&ids_table, id); // recheck, someone could intern it meanwhile
+		if (!interned)
+		{
+			interned = ++ids_count;
+			if (interned >= ids_capacity)
+			{
+				ids_capacity = ids_capacity ? 2 * ids_capacity : 64;
+				ids_names = realloc(ids_names, sizeof(const char *) * ids_capacity);
+				ids_names[0] = NULL;
+			}
+			ids_names[interned] = htable_insert(&ids_table, id, (void *) (uintptr_t) interned);
+			if (ids_fd >= 0)
+				dprintf(ids_fd, "%u %s\n", interned, id); // written right away, so it survives crash
+		}
+		pthread_mutex_unlock(&trace_mutex);
+	}
+
+	if (cache)
+		__atomic_store_n(cache, interned, __ATOMIC_RELAXED);
+
+	return interned;
+}
+
+void trace_record(TRACE_OP op, uint32_t id)
+{
+	trace_record_t record;
+	uint64_t written;
+
+	if (!tracing)
+		return;
+
+	register_self();
+	record = (trace_record_t) { read_tsc(), id, self_index, op, 0 };
+
+	if (self_ring)
+	{
+		written = self_ring->header->written; // written by owning thread only
+		self_ring->records[written & (self_ring->header->capacity - 1)] = record;
+		__atomic_store_n(&self_ring->header->written, written + 1, __ATOMIC_RELEASE);
+	}
+
+	if (timeline_path)
+		timeline_append(&record);
+}
+
+void trace_op(TRACE_OP op, uint32_t *cache, const char *id)
+{
+	if (tracing)
+		trace_record(op, trace_intern(cache, id));
+}
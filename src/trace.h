@@ -0,0 +1,132 @@
+/*
+ * trace.h - Binary execution trace recorder for Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Magic number opening every trace ring file.
+ */
+#define TRACE_MAGIC "CCNTTRC1"
+
+/**
+ * Default number of records in ring of single thread, overridden by
+ * environmental variable C_TRACE_SIZE. Always a power of two.
+ */
+#define TRACE_DEFAULT_SIZE 65536
+
+/**
+ * Maximal length of interleaving interned as id of TRACE_TIMEOUT,
+ * longer ones are cut and end with "..."
+ */
+#define TRACE_LABEL_SIZE 64
+
+/**
+ * Enum representing traced operations
+ * TRACE_BLOCK_BEGIN - c_begin_block called, id is block
+ * TRACE_BLOCK_START - block started after its preds finished, id is block
+ * TRACE_BLOCK_END - block ended, id is block
+ * TRACE_EVENT_WAIT - c_wait_event called on unpublished event, id is event
+ * TRACE_EVENT_WAKE - waiting for event finished, id is event
+ * TRACE_EVENT_PUBLISH - event published, id is event
+ * TRACE_DEADLOCK - watchdog released thread waiting for id (block or event),
+ *                  0 if it released everything
+ * TRACE_TIMEOUT - watchdog finished timed out interleaving, id is interleaving
+ *                 cut to TRACE_LABEL_SIZE
+ * TRACE_ASSERT - assertion failed, id is "file:line"
+ */
+typedef enum
+{
+	TRACE_BLOCK_BEGIN,
+	TRACE_BLOCK_START,
+	TRACE_BLOCK_END,
+	TRACE_EVENT_WAIT,
+	TRACE_EVENT_WAKE,
+	TRACE_EVENT_PUBLISH,
+	TRACE_DEADLOCK,
+	TRACE_TIMEOUT,
+	TRACE_ASSERT,
+} TRACE_OP;
+
+/**
+ * Single trace record as stored in file.
+ * tsc - timestamp counter value (monotonic nanoseconds where TSC is unavailable)
+ * id - interned id, see ids file
+ * thread - index of recording thread
+ * op - TRACE_OP
+ */
+typedef struct
+{
+	uint64_t tsc;
+	uint32_t id;
+	uint16_t thread;
+	uint8_t op;
+	uint8_t reserved;
+} trace_record_t;
+
+/**
+ * Header of trace ring file, followed by capacity records. Record number n
+ * is stored at index n % capacity, so only last capacity records survive.
+ * calibration pairs let decoder convert TSC to nanoseconds.
+ * magic - TRACE_MAGIC
+ * record_size - sizeof(trace_record_t)
+ * capacity - number of records in ring, power of two
+ * written - number of records written so far
+ * tsc0, ns0 - TSC and monotonic clock read at the same moment
+ * tsc1, ns1 - same, read later
+ */
+typedef struct
+{
+	char magic[8];
+	uint32_t record_size;
+	uint32_t capacity;
+	uint64_t written;
+	uint64_t tsc0;
+	uint64_t ns0;
+	uint64_t tsc1;
+	uint64_t ns1;
+} trace_header_t;
+
+/**
+ * Global variable indicating if trace is being recorded, either into rings
+ * or into timeline.
+ */
+extern bool tracing;
+
+/**
+ * Starts recording if environmental variable C_TRACE or C_TIMELINE is set.
+ * Value of C_TRACE is prefix of trace files: PREFIX.ids lists interned ids,
+ * PREFIX.N are rings. Value of C_TIMELINE is path of Chrome trace written
+ * by free_trace.
+ */
+void init_trace();
+
+/**
+ * Writes timeline, unmaps all rings and closes ids file.
+ */
+void free_trace();
+
+/**
+ * Returns interned id of string, assigning new one if needed. cache, if not
+ * NULL, remembers interned id so later calls don't need lookup.
+ * Returns 0 if not tracing.
+ */
+uint32_t trace_intern(uint32_t *cache, const char *id);
+
+/**
+ * Records op on id in ring and timeline buffer of calling thread. Lock-free.
+ */
+void trace_record(TRACE_OP op, uint32_t id);
+
+/**
+ * Convenience function equivalent to trace_record(op, trace_intern(cache, id))
+ * which doesn't touch id at all if not tracing.
+ */
+void trace_op(TRACE_OP op, uint32_t *cache, const char *id);
+
+#endif
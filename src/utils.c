@@ -3,72 +3,83 @@
  * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "utils.h"
 
-static char *stptok(const char *s, char *tok, size_t toklen, const char *brk)
+static bool parse_error(interleaving_t *result, const char *error, size_t pos)
+{
+	result->error = error;
+	result->error_pos = pos;
+	return false;
+}
+
+bool parse_interleaving(const char *str, interleaving_t *result, arena_t *arena)
 {
-	char *lim;
-	char *b;
+	size_t length = strlen(str);
+	size_t max_names = length / 2 + 1; // every name but last is followed by delimiter
+	size_t start = 0;
+	size_t i;
 
-	if (!*s)
-		return NULL;
+	result->names = arena_alloc(arena, sizeof(span_t) * max_names);
+	result->groups = arena_alloc(arena, sizeof(size_t) * (max_names + 1));
+	result->names_count = 0;
+	result->groups_count = 0;
+	result->groups[0] = 0;
+	result->error = NULL;
+	result->error_pos = 0;
 
-	lim = tok + toklen - 1;
-	while (*s && tok < lim)
+	if (length == 0)
+		return true;
+
+	for (i = 0; i <= length; ++i)
 	{
-		for (b = (char *) brk; *b; b++)
+		if (str[i] != ',' && str[i] != ';' && str[i] != '\0')
+			continue;
+
+		if (i == start)
 		{
-			if (*s == *b)
-			{
-				*tok = 0;
-				return (char *) s;
-			}
+			if (str[i] == '\0')
+				return parse_error(result, "trailing delimiter", i - 1);
+			return parse_error(result, "empty block name", i);
 		}
-		*tok++ = *s++;
+
+		result->names[result->names_count].offset = start;
+		result->names[result->names_count].length = i - start;
+		++result->names_count;
+
+		if (str[i] != ',') // group ends
+			result->groups[++result->groups_count] = result->names_count;
+
+		start = i + 1;
 	}
-	*tok = 0;
-	return (char *) s;
+
+	return true;
 }
 
-char **get_tokenized(const char *str, const char *delims)
+unsigned long hash_string_n(const char *str, size_t length)
 {
-	char *stable;
-	char *token;
-	char **ret;
-	int cnt = 0;
-	int i;
-
-	/* count tokens */
-	stable = malloc(strlen(str) + 1);
-	for (token = stptok(str, stable, strlen(str) + 1, delims); token; token = token[0] != '\0' ? stptok(token + 1, stable, strlen(str) + 1, delims) : NULL)
-		++cnt;
+	unsigned long hash = 14695981039346656037UL;
+	size_t i;
 
-	ret = malloc(sizeof(char *) * (cnt + 1));
-	ret[cnt] = NULL;
-
-	for (token = stptok(str, stable, strlen(str) + 1, delims), i = 0; token; token = token[0] != '\0' ? stptok(token + 1, stable, strlen(str) + 1, delims) : NULL, ++i)
+	for (i = 0; i < length; ++i)
 	{
-		ret[i] = malloc(strlen(stable) + 1);
-		strcpy(ret[i], stable);
+		hash ^= (unsigned char) str[i];
+		hash *= 1099511628211UL;
 	}
 
-	free(stable);
-
-	return ret;
+	return hash;
 }
 
-void free_tokenized(char *array[])
+unsigned long long monotonic_ns()
 {
-	int i;
-
-	if (!array)
-		return;
+	struct timespec now;
 
-	for (i = 0; array[i]; ++i)
-		free(array[i]);
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-	free(array);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
 }
@@ -6,14 +6,57 @@
 #ifndef __UTILS_H
 #define __UTILS_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+/**
+ * Fragment of a string.
+ * offset - position of first character
+ * length - number of characters
+ */
+typedef struct
+{
+	size_t offset;
+	size_t length;
+} span_t;
+
+/**
+ * Interleaving split into names of blocks. Names refer to the parsed string.
+ * names - spans of all names, in order of appearance
+ * names_count - number of names
+ * groups - index of first name of each group, groups_count + 1 entries
+ * groups_count - number of ';'-delimited groups
+ * error - description of first syntax error, NULL if none
+ * error_pos - position of first syntax error in parsed string
+ */
+typedef struct
+{
+	span_t *names;
+	size_t names_count;
+	size_t *groups;
+	size_t groups_count;
+	const char *error;
+	size_t error_pos;
+} interleaving_t;
+
+/**
+ * Parses interleaving in a single pass: groups of names delimited with ';',
+ * names within group delimited with ','. Empty string yields no groups.
+ * Allocates two arrays from arena at most, never per name. Returns false
+ * and fills error fields on empty name or dangling delimiter.
+ */
+bool parse_interleaving(const char *str, interleaving_t *result, arena_t *arena);
+
 /**
- * Splits str on delims. Result should be later freed with free_tokenized.
+ * Returns FNV-1a hash of first length characters of str.
  */
-char **get_tokenized(const char *str, const char *delims);
+unsigned long hash_string_n(const char *str, size_t length);
 
 /**
- * Cleaning function for get_tokenized.
+ * Returns current time of monotonic clock in nanoseconds.
  */
-void free_tokenized(char *array[]);
+unsigned long long monotonic_ns();
 
 #endif
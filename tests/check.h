@@ -0,0 +1,14 @@
+#ifndef __CHECK_H
+#define __CHECK_H
+
+#include <stdio.h>
+
+static int checks_failed = 0;
+
+// reports failed condition and goes on, so one run shows all failures, may be used by tested threads
+#define check(COND) do { if (!(COND)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); __atomic_add_fetch(&checks_failed, 1, __ATOMIC_SEQ_CST); } } while (0)
+
+// prints verdict of test and gives its exit status
+#define check_result(NAME) (printf("%s: %s\n", NAME, checks_failed ? "FAILED" : "passed"), checks_failed ? 1 : 0)
+
+#endif
@@ -0,0 +1,57 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "coconut.h"
+
+void *nesting(void *dummy)
+{
+	c_begin_block("p");
+	c_begin_block("q");
+	c_end_block();
+	c_end_block();
+	return NULL;
+}
+
+void *single(void *dummy)
+{
+	c_begin_block("r");
+	c_end_block();
+	return NULL;
+}
+
+void *starving(void *dummy)
+{
+	c_wait_event("never");
+	return NULL;
+}
+
+int main()
+{
+	pthread_t t1;
+	pthread_t t2;
+
+	alarm(30); // unresolved deadlock kills test instead of hanging it
+
+	c_init();
+	c_set_watchdog_tick_ns(10000000);
+	c_set_deadlock_grace(10);
+
+	// q waits for r, which waits for p enclosing q: cycle is broken by starting q early
+	c_set_blocks_interleaving("p;r;q");
+	pthread_create(&t1, NULL, &nesting, NULL);
+	pthread_create(&t2, NULL, &single, NULL);
+	pthread_join(t1, NULL);
+	pthread_join(t2, NULL);
+	check(c_is_after_block("p") && c_is_after_block("q") && c_is_after_block("r"));
+
+	// nobody publishes event, so watchdog does
+	pthread_create(&t1, NULL, &starving, NULL);
+	pthread_join(t1, NULL);
+	check(c_is_event_published("never"));
+
+	c_free();
+
+	return check_result("deadlock");
+}
@@ -0,0 +1,112 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include "check.h"
+#include "coconut.h"
+
+int x;
+int finished;
+int runs;
+
+void setup()
+{
+	x = 0;
+	finished = 0;
+	++runs;
+}
+
+// both threads read x and write it back incremented, last one to finish expects 2
+void finish()
+{
+	if (__atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST) == 2)
+		c_assert_true(x == 2, "lost update, x = %d", x);
+}
+
+void *increment_a(void *dummy)
+{
+	int tmp;
+
+	c_begin_block("a_read");
+	tmp = x;
+	c_end_block();
+
+	c_begin_block("a_write");
+	x = tmp + 1;
+	c_end_block();
+
+	finish();
+	return NULL;
+}
+
+void *increment_b(void *dummy)
+{
+	int tmp;
+
+	c_begin_block("b_read");
+	tmp = x;
+	c_end_block();
+
+	c_begin_block("b_write");
+	x = tmp + 1;
+	c_end_block();
+
+	finish();
+	return NULL;
+}
+
+void *touch_p(void *dummy)
+{
+	c_begin_block("p1");
+	c_end_block();
+	c_begin_block("p2");
+	c_end_block();
+	return NULL;
+}
+
+void *touch_q(void *dummy)
+{
+	c_begin_block("q1");
+	c_end_block();
+	c_begin_block("q2");
+	c_end_block();
+	return NULL;
+}
+
+int main()
+{
+	c_thread_routine_t increments[] = { increment_a, increment_b };
+	c_thread_routine_t touches[] = { touch_p, touch_q };
+	unsigned long failed;
+
+	c_init();
+
+	// no footprints: all 6 linearizations of 2 + 2 blocks, 4 of them read twice before writing
+	runs = 0;
+	failed = c_explore(setup, increments, NULL, 2);
+	check(runs == 1 + 6); // recording pass comes first
+	check(failed == 4);
+
+	// reads commute, so 4 classes are left, 2 of them lose update
+	c_block_footprint("a_read", "x", NULL);
+	c_block_footprint("b_read", "x", NULL);
+	c_block_footprint("a_write", NULL, "x");
+	c_block_footprint("b_write", NULL, "x");
+	runs = 0;
+	failed = c_explore(setup, increments, NULL, 2);
+	check(runs == 1 + 4);
+	check(failed == 2);
+
+	// disjoint resources: every linearization is equivalent to the first one
+	c_block_footprint("p1", NULL, "p");
+	c_block_footprint("p2", NULL, "p");
+	c_block_footprint("q1", NULL, "q");
+	c_block_footprint("q2", NULL, "q");
+	runs = 0;
+	failed = c_explore(setup, touches, NULL, 2);
+	check(runs == 1 + 1);
+	check(failed == 0);
+
+	c_free();
+
+	return check_result("explore");
+}
@@ -0,0 +1,51 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include "check.h"
+#include "coconut.h"
+
+void *nesting(void *dummy)
+{
+	c_begin_block("outer");
+	c_begin_block("inner");
+	check(c_is_during_block("outer") && c_is_during_block("inner"));
+
+	// innermost block ends first
+	c_end_block();
+	check(c_is_during_block("outer") && c_is_after_block("inner"));
+
+	c_end_block();
+	check(c_is_after_block("outer"));
+
+	// unpaired end is reported and ignored
+	c_end_block();
+	return NULL;
+}
+
+void *following(void *dummy)
+{
+	c_begin_block("after");
+	check(c_is_after_block("outer") && c_is_after_block("inner"));
+	c_end_block();
+	return NULL;
+}
+
+int main()
+{
+	pthread_t t1;
+	pthread_t t2;
+
+	c_init();
+	c_set_blocks_interleaving("outer,inner;after");
+
+	pthread_create(&t1, NULL, &following, NULL);
+	pthread_create(&t2, NULL, &nesting, NULL);
+	pthread_join(t1, NULL);
+	pthread_join(t2, NULL);
+
+	check(c_is_after_block("after"));
+
+	c_free();
+
+	return check_result("nested_blocks");
+}
@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "coconut.h"
+
+void *nothing(void *dummy)
+{
+	return NULL;
+}
+
+// runs interleaving and returns error it was rejected with, "" if accepted
+const char *rejection(const char *interleaving)
+{
+	static c_result_t result;
+	c_thread_routine_t routines[] = { nothing };
+
+	result = c_run_schedule(routines, NULL, 1, interleaving);
+	return result.message;
+}
+
+int main()
+{
+	c_init();
+
+	check(strcmp(rejection("a"), "") == 0);
+	check(strcmp(rejection("a,b;c"), "") == 0);
+	check(strcmp(rejection("a;"), "Malformed interleaving: trailing delimiter at position 1") == 0);
+	check(strcmp(rejection("a,"), "Malformed interleaving: trailing delimiter at position 1") == 0);
+	check(strcmp(rejection(";a"), "Malformed interleaving: empty block name at position 0") == 0);
+	check(strcmp(rejection("a;;b"), "Malformed interleaving: empty block name at position 2") == 0);
+	check(strcmp(rejection("a,,b"), "Malformed interleaving: empty block name at position 2") == 0);
+	check(strcmp(rejection("a;b;a"), "Malformed interleaving: duplicated block a at position 4") == 0);
+
+	c_free();
+
+	return check_result("parse");
+}
@@ -0,0 +1,66 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "coconut.h"
+
+char order[8];
+int order_length;
+
+void note(char c)
+{
+	order[__atomic_fetch_add(&order_length, 1, __ATOMIC_SEQ_CST)] = c;
+}
+
+void *waiter(void *dummy)
+{
+	c_wait_event("ready");
+	c_begin_block("second");
+	note('w');
+	c_end_block();
+	return NULL;
+}
+
+void *publisher(void *dummy)
+{
+	c_begin_block("first");
+	note('p');
+	c_end_block();
+	c_publish_event("ready");
+	return NULL;
+}
+
+int main()
+{
+	pthread_t t1;
+	pthread_t t2;
+	int i;
+
+	c_init();
+	c_set_blocks_interleaving("first;second");
+
+	for (i = 0; i < 100; ++i)
+	{
+		// everything starts over after reset, including the first run
+		check(!c_is_event_published("ready"));
+		check(c_is_before_block("first") && c_is_before_block("second"));
+
+		memset(order, 0, sizeof(order));
+		order_length = 0;
+		pthread_create(&t1, NULL, &waiter, NULL);
+		pthread_create(&t2, NULL, &publisher, NULL);
+		pthread_join(t1, NULL);
+		pthread_join(t2, NULL);
+
+		check(strcmp(order, "pw") == 0);
+		check(c_is_event_published("ready"));
+		check(c_is_after_block("first") && c_is_after_block("second"));
+
+		c_reset();
+	}
+
+	c_free();
+
+	return check_result("reset");
+}
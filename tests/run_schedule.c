@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "coconut.h"
+
+char order[8];
+int order_length;
+
+void note(char c)
+{
+	order[__atomic_fetch_add(&order_length, 1, __ATOMIC_SEQ_CST)] = c;
+}
+
+void *block_a(void *dummy)
+{
+	c_begin_block("a");
+	note('a');
+	c_end_block();
+	return NULL;
+}
+
+void *block_b(void *dummy)
+{
+	c_begin_block("b");
+	note('b');
+	c_end_block();
+	return NULL;
+}
+
+void *slow_b(void *dummy)
+{
+	c_begin_block("b");
+	usleep(300000);
+	c_end_block();
+	return NULL;
+}
+
+void *failing_b(void *dummy)
+{
+	c_begin_block("b");
+	c_assert_true(0, "b always fails");
+	c_end_block();
+	return NULL;
+}
+
+c_result_t run(c_thread_routine_t *routines, const char *interleaving)
+{
+	memset(order, 0, sizeof(order));
+	order_length = 0;
+	return c_run_schedule(routines, NULL, 2, interleaving);
+}
+
+int main()
+{
+	c_thread_routine_t routines[] = { block_a, block_b };
+	c_thread_routine_t slow[] = { block_a, slow_b };
+	c_thread_routine_t failing[] = { block_a, failing_b };
+	c_result_t result;
+	int i;
+
+	c_init();
+	c_set_watchdog_tick_ns(10000000);
+
+	// order is enforced on every run, pooled threads are reused
+	for (i = 0; i < 50; ++i)
+	{
+		result = run(routines, "b;a");
+		check(result.passed && strcmp(order, "ba") == 0);
+		result = run(routines, "a;b");
+		check(result.passed && strcmp(order, "ab") == 0);
+	}
+
+	// bad input fails without running routines
+	result = run(routines, "");
+	check(!result.passed && order_length == 0 && strcmp(result.message, "Empty interleaving") == 0);
+	result = run(routines, NULL);
+	check(!result.passed && order_length == 0);
+	result = run(routines, "a;;b");
+	check(!result.passed && order_length == 0 && strncmp(result.message, "Malformed interleaving", 22) == 0);
+
+	// failed assertion is counted and its message kept
+	result = run(failing, "a;b");
+	check(!result.passed && !result.timed_out && result.assertions_failed == 1);
+	check(strstr(result.message, "b always fails") != NULL);
+
+	// run exceeding timeout gets its blocks finished and fails as timed out
+	c_set_schedule_timeout(50000000);
+	result = run(slow, "b;a");
+	check(!result.passed && result.timed_out);
+	c_set_schedule_timeout(0);
+	result = run(routines, "a;b");
+	check(result.passed && !result.timed_out);
+
+	c_free();
+
+	return check_result("run_schedule");
+}
@@ -0,0 +1,172 @@
+/*
+ * trace_decode.c - Decoder of binary traces recorded by Coconut library
+ * Copyright (C) 2013 Lukasz Sowa <contact@lukaszsowa.pl>
+ *
+ * Usage: trace_decode PREFIX
+ * where PREFIX is value of C_TRACE of traced run. Prints records of all
+ * threads ordered by time.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+static const char *op_names[] =
+{
+	[TRACE_BLOCK_BEGIN] = "block begin",
+	[TRACE_BLOCK_START] = "block start",
+	[TRACE_BLOCK_END] = "block end",
+	[TRACE_EVENT_WAIT] = "event wait",
+	[TRACE_EVENT_WAKE] = "event wake",
+	[TRACE_EVENT_PUBLISH] = "event publish",
+	[TRACE_DEADLOCK] = "deadlock",
+	[TRACE_TIMEOUT] = "timeout",
+	[TRACE_ASSERT] = "assert failed",
+};
+
+typedef struct
+{
+	trace_record_t record;
+	unsigned long seq; // keeps order of records with equal tsc stable
+} entry_t;
+
+static char **ids = NULL;
+static size_t ids_count = 0;
+
+static void read_ids(const char *prefix)
+{
+	char path[4096];
+	char *line = NULL;
+	size_t line_size = 0;
+	unsigned int id;
+	int name_pos;
+	FILE *file;
+
+	snprintf(path, sizeof(path), "%s.ids", prefix);
+	if (!(file = fopen(path, "r")))
+	{
+		fprintf(stderr, "Cannot open %s, ids won't be resolved\n", path);
+		return;
+	}
+
+	while (getline(&line, &line_size, file) != -1) // ids may be arbitrarily long
+	{
+		if (sscanf(line, "%u %n", &id, &name_pos) != 1)
+			continue;
+		line[strcspn(line, "\n")] = '\0';
+		if (id >= ids_count)
+		{
+			ids = realloc(ids, sizeof(char *) * (id + 1));
+			memset(ids + ids_count, 0, sizeof(char *) * (id + 1 - ids_count));
+			ids_count = id + 1;
+		}
+		ids[id] = strdup(line + name_pos);
+	}
+
+	free(line);
+	fclose(file);
+}
+
+static const char *id_name(uint32_t id)
+{
+	if (id == 0)
+		return "-";
+	return id < ids_count && ids[id] ? ids[id] : "?";
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	const entry_t *x = a, *y = b;
+
+	if (x->record.tsc != y->record.tsc)
+		return x->record.tsc < y->record.tsc ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+int main(int argc, char **argv)
+{
+	char path[4096];
+	trace_header_t header;
+	trace_header_t first = { .tsc0 = 0 };
+	bool have_first = false;
+	entry_t *entries = NULL;
+	size_t entries_count = 0;
+	uint64_t count, start, i;
+	double ns_per_tick = 1.0;
+	unsigned int ring;
+	FILE *file;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "Usage: %s PREFIX\n", argv[0]);
+		return 1;
+	}
+
+	read_ids(argv[1]);
+
+	for (ring = 0; ; ++ring)
+	{
+		snprintf(path, sizeof(path), "%s.%u", argv[1], ring);
+		if (!(file = fopen(path, "rb")))
+			break;
+
+		if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.record_size != sizeof(trace_record_t))
+		{
+			fprintf(stderr, "%s is not a trace file, skipping\n", path);
+			fclose(file);
+			continue;
+		}
+		if (!have_first)
+		{
+			first = header;
+			have_first = true;
+		}
+
+		// only last capacity records survive, oldest of them sits right after newest
+		count = header.written < header.capacity ? header.written : header.capacity;
+		start = header.written - count;
+		if (start)
+			fprintf(stderr, "%s: %llu oldest records overwritten\n", path, (unsigned long long) start);
+
+		entries = realloc(entries, sizeof(entry_t) * (entries_count + count));
+		for (i = start; i < header.written; ++i)
+		{
+			fseek(file, sizeof(header) + (i % header.capacity) * sizeof(trace_record_t), SEEK_SET);
+			if (fread(&entries[entries_count].record, sizeof(trace_record_t), 1, file) != 1)
+				break;
+			entries[entries_count].seq = entries_count;
+			++entries_count;
+		}
+		fclose(file);
+	}
+
+	if (ring == 0)
+	{
+		fprintf(stderr, "No trace files found for prefix %s\n", argv[1]);
+		return 1;
+	}
+
+	if (first.tsc1 > first.tsc0)
+		ns_per_tick = (double) (first.ns1 - first.ns0) / (first.tsc1 - first.tsc0);
+
+	qsort(entries, entries_count, sizeof(entry_t), compare_entries);
+
+	for (i = 0; i < entries_count; ++i)
+		printf("%14.3f us  thread #%-4u %-14s %s\n",
+			((double) entries[i].record.tsc - first.tsc0) * ns_per_tick / 1000.0,
+			entries[i].record.thread,
+			entries[i].record.op < sizeof(op_names) / sizeof(op_names[0]) ? op_names[entries[i].record.op] : "?",
+			id_name(entries[i].record.id));
+
+	free(entries);
+	for (i = 0; i < ids_count; ++i)
+		free(ids[i]);
+	free(ids);
+
+	return 0;
+}